@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+#include "analyzer.h"
+
+#define ANALYSIS_UNREACHED (-1000000)
+
+//======================================================
+// Decoding
+//======================================================
+
+// the classic word for an instruction with its address dropped, e.g. BRA 1234 is 600 and JAL is 910
+// in either encoding, -1 for a word that is not an instruction
+int lmsm_analysis_kind(lmsm_analysis *analysis, int word) {
+    int opcode = word / analysis->address_radix;
+    int operand = word % analysis->address_radix;
+    if (word == 0) {
+        return 0;
+    } else if (1 <= opcode && opcode <= 8) {
+        return opcode * 100;
+    } else if (opcode == 9 && (operand == 1 || operand == 2 || operand == 10 || operand == 11 ||
+                               (20 <= operand && operand <= 24) || (30 <= operand && operand <= 35))) {
+        return 900 + operand;
+    }
+    return -1;
+}
+
+int lmsm_analysis_operand(lmsm_analysis *analysis, int word) {
+    return word % analysis->address_radix;
+}
+
+// CALL assembles to LDI <target>, SPUSH, JAL, any other JAL jumps to a computed address
+int lmsm_analysis_call_target(lmsm_analysis *analysis, int slot) {
+    if (slot >= 2 && lmsm_analysis_kind(analysis, analysis->code[slot - 2]) == 400 &&
+        lmsm_analysis_kind(analysis, analysis->code[slot - 1]) == 920) {
+        int target = lmsm_analysis_operand(analysis, analysis->code[slot - 2]);
+        return target < analysis->code_size ? target : -1;
+    }
+    return -1;
+}
+
+// fills in the slots control can reach next within the function, calls return to the next slot
+int lmsm_analysis_successors(lmsm_analysis *analysis, int slot, int *successors) {
+    int kind = lmsm_analysis_kind(analysis, analysis->code[slot]);
+    if (kind == 600) {
+        successors[0] = lmsm_analysis_operand(analysis, analysis->code[slot]);
+        return 1;
+    } else if (kind == 700 || kind == 800) {
+        successors[0] = lmsm_analysis_operand(analysis, analysis->code[slot]);
+        successors[1] = slot + 1;
+        return 2;
+    } else if (kind == 0 || kind == 911 || kind == -1) {
+        return 0; // HLT, RET, and unknown instructions (which halt the machine)
+    }
+    successors[0] = slot + 1;
+    return 1;
+}
+
+int lmsm_analysis_stack_effect(int kind) {
+    if (kind == 920 || kind == 922) {
+        return 1;
+    } else if (kind == 921 || kind == 923 || kind == 910 || (930 <= kind && kind <= 935)) {
+        return -1;
+    }
+    return 0;
+}
+
+void lmsm_analysis_explain(char *reason, char *format, int first, int second) {
+    // the first reason found is the innermost one, so keep it
+    if (reason[0] == '\0') {
+        snprintf(reason, 100, format, first, second);
+    }
+}
+
+//======================================================
+// Function Analysis
+//======================================================
+
+void lmsm_analyze_function(lmsm_analysis *analysis, int entry);
+
+long lmsm_analysis_longest_path(lmsm_analysis *analysis, int slot, int *color, long *memo,
+                                int (*successors)[2], int *successor_count) {
+    if (color[slot] == 2) {
+        return memo[slot];
+    }
+    color[slot] = 1;
+
+    long cost = 1;
+    if (lmsm_analysis_kind(analysis, analysis->code[slot]) == 910) {
+        int target = lmsm_analysis_call_target(analysis, slot);
+        lmsm_function_analysis *callee = &analysis->functions[target];
+        if (callee->state != ANALYSIS_DONE) {
+            lmsm_analysis_explain(analysis->cycles_reason, "recursive call at %02d to the function at %02d", slot, target);
+            return -1;
+        } else if (callee->worst_case_instructions == -1) {
+            return -1;
+        }
+        cost += callee->worst_case_instructions;
+    }
+
+    long longest = 0;
+    for (int i = 0; i < successor_count[slot]; ++i) {
+        int next = successors[slot][i];
+        if (color[next] == 1) {
+            lmsm_analysis_explain(analysis->cycles_reason, "loop from %02d back to %02d", slot, next);
+            return -1;
+        }
+        long path = lmsm_analysis_longest_path(analysis, next, color, memo, successors, successor_count);
+        if (path == -1) {
+            return -1;
+        }
+        if (path > longest) {
+            longest = path;
+        }
+    }
+
+    color[slot] = 2;
+    memo[slot] = cost + longest;
+    return memo[slot];
+}
+
+void lmsm_analysis_value_stack(lmsm_analysis *analysis, int entry, int (*successors)[2], int *successor_count) {
+    lmsm_function_analysis *function = &analysis->functions[entry];
+    int code_size = analysis->code_size;
+    int *depth_in = malloc(sizeof(int) * code_size);
+    int *queued = calloc(code_size, sizeof(int));
+    int *worklist = malloc(sizeof(int) * code_size);
+    int head = 0;
+    int size = 0;
+    for (int i = 0; i < code_size; ++i) {
+        depth_in[i] = ANALYSIS_UNREACHED;
+    }
+    depth_in[entry] = 0;
+    worklist[0] = entry;
+    queued[entry] = 1;
+    size = 1;
+
+    int peak = 0;
+    int effect = ANALYSIS_UNREACHED;
+    while (size > 0) {
+        int slot = worklist[head];
+        head = (head + 1) % code_size;
+        size--;
+        queued[slot] = 0;
+
+        int kind = lmsm_analysis_kind(analysis, analysis->code[slot]);
+        int depth = depth_in[slot];
+        int out = depth + lmsm_analysis_stack_effect(kind);
+        int slot_peak = depth > out ? depth : out;
+        if (kind == 910) {
+            // JAL pops the target, then the callee runs on top of what is left
+            int target = lmsm_analysis_call_target(analysis, slot);
+            lmsm_function_analysis *callee = &analysis->functions[target];
+            if (callee->state != ANALYSIS_DONE) {
+                lmsm_analysis_explain(analysis->value_stack_reason, "recursive call at %02d to the function at %02d", slot, target);
+                function->max_value_stack = -1;
+                break;
+            } else if (callee->max_value_stack == -1) {
+                function->max_value_stack = -1;
+                break;
+            }
+            if (out + callee->max_value_stack > slot_peak) {
+                slot_peak = out + callee->max_value_stack;
+            }
+            out += callee->value_stack_effect;
+        } else if (kind == 911 && depth > effect) {
+            effect = depth;
+        }
+        if (slot_peak > peak) {
+            peak = slot_peak;
+        }
+
+        for (int i = 0; i < successor_count[slot]; ++i) {
+            int next = successors[slot][i];
+            if (out <= depth_in[next]) {
+                continue;
+            }
+            if (out > code_size) {
+                lmsm_analysis_explain(analysis->value_stack_reason, "value stack grows in the loop through %02d", next, 0);
+                function->max_value_stack = -1;
+                break;
+            }
+            depth_in[next] = out;
+            if (!queued[next]) {
+                worklist[(head + size) % code_size] = next;
+                queued[next] = 1;
+                size++;
+            }
+        }
+        if (function->max_value_stack == -1) {
+            break;
+        }
+    }
+    if (function->max_value_stack != -1) {
+        function->max_value_stack = peak;
+        function->value_stack_effect = effect == ANALYSIS_UNREACHED ? 0 : effect;
+    }
+    free(depth_in);
+    free(queued);
+    free(worklist);
+}
+
+void lmsm_analyze_function(lmsm_analysis *analysis, int entry) {
+    lmsm_function_analysis *function = &analysis->functions[entry];
+    function->state = ANALYSIS_IN_PROGRESS;
+
+    // find every slot of the function, analysing callees as they are found
+    int code_size = analysis->code_size;
+    int (*successors)[2] = malloc(sizeof(int[2]) * code_size);
+    int *successor_count = calloc(code_size, sizeof(int));
+    int *reachable = calloc(code_size, sizeof(int));
+    int *order = malloc(sizeof(int) * code_size);
+    int count = 0;
+    int followed = 1;
+    int calls_known = 1;
+    reachable[entry] = 1;
+    order[count++] = entry;
+    for (int i = 0; i < count; ++i) {
+        int slot = order[i];
+        int found = lmsm_analysis_successors(analysis, slot, successors[slot]);
+        for (int j = 0; j < found; ++j) {
+            int next = successors[slot][j];
+            if (next < 0 || next >= code_size) {
+                lmsm_analysis_explain(analysis->cycles_reason, "control leaves code space after %02d", slot, 0);
+                followed = 0;
+            } else {
+                successors[slot][successor_count[slot]++] = next;
+                if (!reachable[next]) {
+                    reachable[next] = 1;
+                    order[count++] = next;
+                }
+            }
+        }
+        if (lmsm_analysis_kind(analysis, analysis->code[slot]) == 910) {
+            int target = lmsm_analysis_call_target(analysis, slot);
+            if (target == -1) {
+                lmsm_analysis_explain(analysis->cycles_reason, "indirect JAL at %02d", slot, 0);
+                lmsm_analysis_explain(analysis->value_stack_reason, "indirect JAL at %02d", slot, 0);
+                lmsm_analysis_explain(analysis->return_stack_reason, "indirect JAL at %02d", slot, 0);
+                calls_known = 0;
+            } else if (analysis->functions[target].state == ANALYSIS_NOT_STARTED) {
+                lmsm_analyze_function(analysis, target);
+            }
+        }
+    }
+
+    if (!followed || !calls_known) {
+        function->worst_case_instructions = -1;
+    } else {
+        int *color = calloc(code_size, sizeof(int));
+        long *memo = malloc(sizeof(long) * code_size);
+        function->worst_case_instructions = lmsm_analysis_longest_path(analysis, entry, color, memo,
+                                                                       successors, successor_count);
+        free(color);
+        free(memo);
+    }
+
+    if (!calls_known) {
+        function->max_value_stack = -1;
+        function->max_return_stack = -1;
+    } else {
+        lmsm_analysis_value_stack(analysis, entry, successors, successor_count);
+
+        function->max_return_stack = 0;
+        for (int i = 0; i < count && function->max_return_stack != -1; ++i) {
+            int slot = order[i];
+            if (lmsm_analysis_kind(analysis, analysis->code[slot]) != 910) {
+                continue;
+            }
+            int target = lmsm_analysis_call_target(analysis, slot);
+            lmsm_function_analysis *callee = &analysis->functions[target];
+            if (callee->state != ANALYSIS_DONE) {
+                lmsm_analysis_explain(analysis->return_stack_reason, "recursive call at %02d to the function at %02d", slot, target);
+                function->max_return_stack = -1;
+            } else if (callee->max_return_stack == -1) {
+                function->max_return_stack = -1;
+            } else if (callee->max_return_stack + 1 > function->max_return_stack) {
+                function->max_return_stack = callee->max_return_stack + 1;
+            }
+        }
+    }
+
+    free(successors);
+    free(successor_count);
+    free(reachable);
+    free(order);
+    function->state = ANALYSIS_DONE;
+}
+
+//======================================================
+// Main API
+//======================================================
+
+lmsm_analysis *lmsm_analyze(int *code, int length, int address_radix) {
+    lmsm_analysis *analysis = calloc(1, sizeof(lmsm_analysis));
+    analysis->code = malloc(sizeof(int) * length);
+    analysis->functions = calloc(length, sizeof(lmsm_function_analysis));
+    analysis->code_size = length;
+    analysis->address_radix = address_radix;
+    memcpy(analysis->code, code, sizeof(int) * length);
+    lmsm_analyze_function(analysis, 0);
+    analysis->worst_case_instructions = analysis->functions[0].worst_case_instructions;
+    analysis->max_value_stack = analysis->functions[0].max_value_stack;
+    analysis->max_return_stack = analysis->functions[0].max_return_stack;
+    return analysis;
+}
+
+void lmsm_analysis_delete(lmsm_analysis *analysis) {
+    free(analysis->code);
+    free(analysis->functions);
+    free(analysis);
+}
+
+void lmsm_analysis_print(lmsm_analysis *analysis, FILE *out) {
+    if (analysis->worst_case_instructions == -1) {
+        fprintf(out, "Worst case instructions:         unbounded (%s)\n", analysis->cycles_reason);
+    } else {
+        fprintf(out, "Worst case instructions:         %ld\n", analysis->worst_case_instructions);
+    }
+    if (analysis->max_value_stack == -1) {
+        fprintf(out, "Max value stack depth:           unbounded (%s)\n", analysis->value_stack_reason);
+    } else {
+        fprintf(out, "Max value stack depth:           %d\n", analysis->max_value_stack);
+    }
+    if (analysis->max_return_stack == -1) {
+        fprintf(out, "Max return address stack depth:  unbounded (%s)\n", analysis->return_stack_reason);
+    } else {
+        fprintf(out, "Max return address stack depth:  %d\n", analysis->max_return_stack);
+    }
+}
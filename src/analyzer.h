@@ -0,0 +1,54 @@
+#ifndef LMSM_ANALYZER_H
+#define LMSM_ANALYZER_H
+
+#include <stdio.h>
+
+
+//===================================================================
+//  Per-function facts, slots are indexed by the function entry
+//===================================================================
+
+typedef enum analysis_state {
+    ANALYSIS_NOT_STARTED,
+    ANALYSIS_IN_PROGRESS,
+    ANALYSIS_DONE,
+} analysis_state;
+
+typedef struct lmsm_function_analysis {
+    analysis_state state;
+    long worst_case_instructions;  // -1 when unbounded
+    int max_value_stack;           // deepest value stack relative to the entry, -1 when unbounded
+    int value_stack_effect;        // value stack change from entry to RET
+    int max_return_stack;          // deepest call nesting below this function, -1 when unbounded
+} lmsm_function_analysis;
+
+//===================================================================
+//  The result of statically analysing a program
+//===================================================================
+
+typedef struct lmsm_analysis {
+    int *code;
+    int code_size;                 // the stacks share as many slots again above the code
+    int address_radix;
+    lmsm_function_analysis *functions;  // indexed by entry slot
+    long worst_case_instructions;  // -1 when unbounded
+    int max_value_stack;           // -1 when unbounded
+    int max_return_stack;          // -1 when unbounded
+    char cycles_reason[100];       // why the instruction count is unbounded, e.g. the responsible loop
+    char value_stack_reason[100];
+    char return_stack_reason[100];
+} lmsm_analysis;
+
+//=====================================================
+// API
+//=====================================================
+
+// analyses the control flow of a program loaded at slot 0 without running it,
+// length is the code size of the machine and address_radix its instruction encoding
+lmsm_analysis *lmsm_analyze(int *code, int length, int address_radix);
+
+void lmsm_analysis_delete(lmsm_analysis *analysis);
+
+void lmsm_analysis_print(lmsm_analysis *analysis, FILE *out);
+
+#endif //LMSM_ANALYZER_H
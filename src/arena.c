@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1))
+
+//======================================================
+// Chunks
+//======================================================
+
+char *lmsm_arena_chunk_data(lmsm_arena_chunk *chunk) {
+    return (char *) chunk + ARENA_ALIGN(sizeof(lmsm_arena_chunk));
+}
+
+lmsm_arena_chunk *lmsm_arena_new_chunk(size_t size) {
+    // calloc'd so every allocation starts out zeroed
+    lmsm_arena_chunk *chunk = calloc(1, ARENA_ALIGN(sizeof(lmsm_arena_chunk)) + size);
+    chunk->size = size;
+    return chunk;
+}
+
+//======================================================
+// Allocation
+//======================================================
+
+void *lmsm_arena_alloc(lmsm_arena *arena, size_t size) {
+    size = ARENA_ALIGN(size ? size : 1);
+    lmsm_arena_chunk *chunk = arena->chunks;
+    if (chunk != NULL && chunk->size - chunk->used >= size) {
+        void *allocation = lmsm_arena_chunk_data(chunk) + chunk->used;
+        chunk->used += size;
+        return allocation;
+    }
+    if (size > ARENA_CHUNK_SIZE / 4 && chunk != NULL) {
+        // a big allocation gets a chunk of its own, behind the one being filled
+        lmsm_arena_chunk *own = lmsm_arena_new_chunk(size);
+        own->used = size;
+        own->next = chunk->next;
+        chunk->next = own;
+        return lmsm_arena_chunk_data(own);
+    }
+    chunk = lmsm_arena_new_chunk(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    chunk->used = size;
+    return lmsm_arena_chunk_data(chunk);
+}
+
+char *lmsm_arena_strndup(lmsm_arena *arena, const char *start, size_t length) {
+    char *copy = lmsm_arena_alloc(arena, length + 1);
+    memcpy(copy, start, length);
+    return copy;
+}
+
+void lmsm_arena_free(lmsm_arena *arena) {
+    lmsm_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        lmsm_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
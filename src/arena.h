@@ -0,0 +1,36 @@
+#ifndef LMSM_ARENA_H
+#define LMSM_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+//===================================================================
+//  A bump allocator for data that all dies at the same time, e.g.
+//  everything built while assembling one program
+//===================================================================
+
+typedef struct lmsm_arena_chunk {
+    struct lmsm_arena_chunk *next;
+    size_t used;
+    size_t size;               // bytes available after the (aligned) chunk header
+} lmsm_arena_chunk;
+
+typedef struct lmsm_arena {
+    lmsm_arena_chunk *chunks;  // the chunk being filled is first
+} lmsm_arena;
+
+//=====================================================
+// API
+//=====================================================
+
+// returns size zeroed bytes aligned for any type, they live until lmsm_arena_free
+void *lmsm_arena_alloc(lmsm_arena *arena, size_t size);
+
+// copies length chars of start into the arena as a NUL terminated string
+char *lmsm_arena_strndup(lmsm_arena *arena, const char *start, size_t length);
+
+// frees every allocation at once, the arena can be used again afterwards
+void lmsm_arena_free(lmsm_arena *arena);
+
+#endif //LMSM_ARENA_H
@@ -1,46 +1,92 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 #include "assembler.h"
+#include "lmsm.h"
 
 char *ASM_ERROR_UNKNOWN_INSTRUCTION = "Unknown Assembly Instruction";
 char *ASM_ERROR_ARG_REQUIRED = "Argument Required";
 char *ASM_ERROR_BAD_LABEL = "Bad Label";
+char *ASM_ERROR_DUPLICATE_LABEL = "Duplicate Label";
 char *ASM_ERROR_OUT_OF_RANGE = "Number is out of range";
+char *ASM_ERROR_PROGRAM_TOO_LARGE = "Program is too large for memory";
 
 //=========================================================
 //  All the instructions available on the LMSM architecture
 //=========================================================
-const char *INSTRUCTIONS[28] = //array of pointers
-        {"ADD", "SUB", "LDA", "STA", "BRA", "BRZ", "BRP",
-         "INP","OUT", "HLT", "COB", "DAT","LDI","JAL",
-         "CALL", "RET","SPUSH", "SPUSHI", "SPOP", "SDUP",
-         "SDROP", "SSWAP","SADD", "SSUB", "SMAX", "SMIN",
-         "SMUL", "SDIV"
-        };
-const int INSTRUCTION_COUNT = 28;
-// PSEUDO INSTRUCTIONS
-// 1) SPUSHI - LDI <XX> and SPUSH
-// 2) CALL <XX> - LDI <XX> and SPUSH and JAL
-
-//===================================================================
-//  All the instructions that require an arg on the LMSM architecture
-//===================================================================
-const char *ARG_INSTRUCTIONS[11] =
-        {"ADD", "SUB", "LDA", "STA", "BRA", "BRZ", "BRP", "DAT",
-         "LDI",
-         "CALL",
-         "SPUSHI"
-        };
-const int ARG_INSTRUCTION_COUNT = 11;
+const asm_mnemonic ASM_MNEMONICS[] = {
+        {"ADD",    1, 1, {{1, ASM_ARGUMENT}}},
+        {"SUB",    1, 1, {{2, ASM_ARGUMENT}}},
+        {"LDA",    1, 1, {{5, ASM_ARGUMENT}}},
+        {"STA",    1, 1, {{3, ASM_ARGUMENT}}},
+        {"BRA",    1, 1, {{6, ASM_ARGUMENT}}},
+        {"BRZ",    1, 1, {{7, ASM_ARGUMENT}}},
+        {"BRP",    1, 1, {{8, ASM_ARGUMENT}}},
+        {"INP",    0, 1, {{9, 1}}},
+        {"OUT",    0, 1, {{9, 2}}},
+        {"HLT",    0, 1, {{0, 0}}},
+        {"COB",    0, 1, {{0, 0}}},
+        {"DAT",    1, 1, {{ASM_RAW_WORD, ASM_ARGUMENT}}},
+        {"LDI",    1, 1, {{4, ASM_ARGUMENT}}},
+        {"JAL",    0, 1, {{9, 10}}},
+        {"CALL",   1, 3, {{4, ASM_ARGUMENT}, {9, 20}, {9, 10}}},   // LDI <XX>, SPUSH, JAL
+        {"RET",    0, 1, {{9, 11}}},
+        {"SPUSH",  0, 1, {{9, 20}}},
+        {"SPUSHI", 1, 2, {{4, ASM_ARGUMENT}, {9, 20}}},            // LDI <XX>, SPUSH
+        {"SPOP",   0, 1, {{9, 21}}},
+        {"SDUP",   0, 1, {{9, 22}}},
+        {"SDROP",  0, 1, {{9, 23}}},
+        {"SSWAP",  0, 1, {{9, 24}}},
+        {"SADD",   0, 1, {{9, 30}}},
+        {"SSUB",   0, 1, {{9, 31}}},
+        {"SMAX",   0, 1, {{9, 34}}},
+        {"SMIN",   0, 1, {{9, 35}}},
+        {"SMUL",   0, 1, {{9, 32}}},
+        {"SDIV",   0, 1, {{9, 33}}},
+};
+
+//=========================================================
+//  A perfect hash of the mnemonics above, the bucket of a
+//  mnemonic is (4 * first + 11 * second + 28 * last + length) & 63
+//  and holds its index in ASM_MNEMONICS.  The table is built from
+//  the mnemonics on first use, and the multipliers were found by
+//  search so no two share a bucket.  A mnemonic added to the list
+//  that collides stops the assembler there, naming both, and
+//  means searching for new multipliers.
+//=========================================================
+#define ASM_MNEMONIC_COUNT ((int) (sizeof(ASM_MNEMONICS) / sizeof(ASM_MNEMONICS[0])))
+#define ASM_MNEMONIC_BUCKET_COUNT 64
+
+signed char ASM_MNEMONIC_BUCKETS[ASM_MNEMONIC_BUCKET_COUNT];
+pthread_once_t ASM_MNEMONIC_BUCKETS_BUILT = PTHREAD_ONCE_INIT;
+
+int asm_mnemonic_bucket(const char *start, int length) {
+    return (4 * start[0] + 11 * start[1] + 28 * start[length - 1] + length) & (ASM_MNEMONIC_BUCKET_COUNT - 1);
+}
+
+void asm_build_mnemonic_buckets() {
+    memset(ASM_MNEMONIC_BUCKETS, -1, sizeof(ASM_MNEMONIC_BUCKETS));
+    for (int i = 0; i < ASM_MNEMONIC_COUNT; ++i) {
+        const char *name = ASM_MNEMONICS[i].name;
+        int bucket = asm_mnemonic_bucket(name, (int) strlen(name));
+        if (ASM_MNEMONIC_BUCKETS[bucket] != -1) {
+            fprintf(stderr, "Mnemonics %s and %s share hash bucket %d, the multipliers need searching again\n",
+                    ASM_MNEMONICS[ASM_MNEMONIC_BUCKETS[bucket]].name, name, bucket);
+            abort();
+        }
+        ASM_MNEMONIC_BUCKETS[bucket] = (signed char) i;
+    }
+}
 
 //======================================================
 // Constructors/Destructors
 //======================================================
 
-asm_instruction * asm_make_instruction(char* type, char *label, char *label_reference, int value, asm_instruction * predecessor) {
-    asm_instruction *new_instruction = calloc(1, sizeof(asm_instruction));
-    new_instruction->instruction = type;
+asm_instruction * asm_make_instruction(lmsm_arena *arena, const asm_mnemonic *mnemonic, char *label, char *label_reference, int value, asm_instruction * predecessor) {
+    asm_instruction *new_instruction = lmsm_arena_alloc(arena, sizeof(asm_instruction));
+    new_instruction->instruction = (char *) mnemonic->name;
+    new_instruction->mnemonic = mnemonic;
     new_instruction->label = label;
     new_instruction->label_reference = label_reference;
     new_instruction->value = value;
@@ -52,82 +98,177 @@ asm_instruction * asm_make_instruction(char* type, char *label, char *label_refe
     } else {
         new_instruction->offset = 0;
     }
-    // Below strcmp takes in two pointers and returns 0 if they are equal
-    if (strcmp(type, INSTRUCTIONS[14]) == 0) { // Pseudo instruction CALL
-        new_instruction->slots = 3;
-    } else if (strcmp(type, INSTRUCTIONS[17]) == 0){ // Pseudo instruction SPUSHI
-        new_instruction->slots = 2;
-    } else {
-        new_instruction ->slots = 1;
-    }
+    new_instruction->slots = mnemonic->slots;
     return new_instruction;
 }
 
-void asm_delete_instruction(asm_instruction *instruction) {
-    if (instruction == NULL) {
-        return;
-    }
-    asm_delete_instruction(instruction->next);
-    free(instruction);
+asm_compilation_result * asm_make_sized_compilation_result(int code_size, int address_radix) {
+    asm_compilation_result *result = calloc(1, sizeof(asm_compilation_result));
+    result->code = lmsm_arena_alloc(&result->arena, code_size * sizeof(int));
+    result->source_map = lmsm_arena_alloc(&result->arena, code_size * sizeof(asm_source_location));
+    result->code_size = code_size;
+    result->address_radix = address_radix;
+    return result;
 }
 
 asm_compilation_result * asm_make_compilation_result() {
-    asm_compilation_result *result = calloc(1, sizeof(asm_compilation_result));
-    return result;
+    return asm_make_sized_compilation_result(CODE_SIZE, ADDRESS_RADIX);
 }
 
 void asm_delete_compilation_result(asm_compilation_result *result) {
-    asm_delete_instruction(result->root);
+    // the instructions, their strings and the code all live in the arena
+    lmsm_arena_free(&result->arena);
     free(result);
 }
 
 //======================================================
 // Helpers
 //======================================================
-int asm_is_instruction(char * token) {
-    for (int i = 0; i < INSTRUCTION_COUNT; ++i) {
-        if (strcmp(token, INSTRUCTIONS[i]) == 0) {
-            return 1;
-        }
+const asm_mnemonic *asm_find_mnemonic(const char *start, int length) {
+    if (length < 2) {
+        return NULL;
+    }
+    pthread_once(&ASM_MNEMONIC_BUCKETS_BUILT, asm_build_mnemonic_buckets);
+    int index = ASM_MNEMONIC_BUCKETS[asm_mnemonic_bucket(start, length)];
+    if (index == -1) {
+        return NULL;
     }
-    return 0;
+    const asm_mnemonic *mnemonic = &ASM_MNEMONICS[index];
+    if (strncmp(start, mnemonic->name, length) != 0 || mnemonic->name[length] != '\0') {
+        return NULL;
+    }
+    return mnemonic;
 }
 
-int asm_instruction_requires_arg(char * token) {
-    for (int i = 0; i < ARG_INSTRUCTION_COUNT; ++i) {
-        if (strcmp(token, ARG_INSTRUCTIONS[i]) == 0) {
-            return 1;
+int asm_is_instruction(char * token) {
+    return asm_find_mnemonic(token, (int) strlen(token)) != NULL;
+}
+
+int asm_is_num_slice(const char *start, int length) {
+    const char *end = start + length;
+    if (start < end && *start == '-') { // allow a leading negative
+        start++;
+    }
+    if (start == end) {
+        return 0;
+    }
+    while (start < end) {
+        if (*start < '0' || '9' < *start) {
+            return 0;
         }
+        start++;
     }
-    return 0;
+    return 1;
 }
 
 int asm_is_num(char * token){
-    if (*token == '-') { // allow a leading negative
-        token++;
-        if (*token == '\0') {
-            return 0;
+    return asm_is_num_slice(token, (int) strlen(token));
+}
+
+// the value of a slice accepted by asm_is_num_slice, huge numbers stop growing past any valid argument
+int asm_parse_num(const char *start, int length) {
+    const char *end = start + length;
+    int negative = *start == '-';
+    int value = 0;
+    for (start += negative; start < end; ++start) {
+        if (value < 1000000) {
+            value = value * 10 + (*start - '0');
         }
     }
-    while (*token != '\0') {
-        if (*token < '0' || '9' < *token) {
-            return 0;
+    return negative ? -value : value;
+}
+//======================================================
+// Symbol Table
+//======================================================
+
+unsigned int asm_hash_label(const char *label) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    while (*label != '\0') {
+        hash = (hash ^ (unsigned char) *label++) * 16777619u;
+    }
+    return hash;
+}
+
+// the bucket holding the label, or the empty bucket it would go in
+int asm_symbol_bucket(asm_symbol_table *table, char *label, unsigned int hash) {
+    int mask = table->bucket_count - 1;
+    int bucket = (int) (hash & (unsigned int) mask);
+    while (table->buckets[bucket] != -1) {
+        asm_symbol *symbol = &table->symbols[table->buckets[bucket]];
+        if (symbol->hash == hash && strcmp(symbol->name, label) == 0) {
+            break;
         }
-        token++;
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+void asm_grow_symbol_table(lmsm_arena *arena, asm_symbol_table *table) {
+    // old arrays stay in the arena until it is freed, growth doubles so that is bounded
+    int capacity = table->capacity ? table->capacity * 2 : 32;
+    asm_symbol *symbols = lmsm_arena_alloc(arena, capacity * sizeof(asm_symbol));
+    if (table->count) {
+        memcpy(symbols, table->symbols, table->count * sizeof(asm_symbol));
+    }
+    table->symbols = symbols;
+    table->capacity = capacity;
+
+    table->bucket_count = capacity * 2;
+    table->buckets = lmsm_arena_alloc(arena, table->bucket_count * sizeof(int));
+    memset(table->buckets, 0xFF, table->bucket_count * sizeof(int));
+    for (int i = 0; i < table->count; ++i) {
+        table->buckets[asm_symbol_bucket(table, table->symbols[i].name, table->symbols[i].hash)] = i;
+    }
+}
+
+int asm_symbol_table_add(lmsm_arena *arena, asm_symbol_table *table, char *name, int offset) {
+    if (table->count == table->capacity) {
+        asm_grow_symbol_table(arena, table);
+    }
+    unsigned int hash = asm_hash_label(name);
+    int bucket = asm_symbol_bucket(table, name, hash);
+    if (table->buckets[bucket] != -1) {
+        return 0;
     }
+    asm_symbol *symbol = &table->symbols[table->count];
+    symbol->name = name;
+    symbol->offset = offset;
+    symbol->hash = hash;
+    table->buckets[bucket] = table->count++;
     return 1;
 }
-// asm_instruction is a struct
-int asm_find_label(asm_instruction *root, char *label) {
-    // TODO - scan the linked list for the given label, return -1 if not found
-    asm_instruction *current = root;
-    while (current != NULL){
-        if (current->label && strcmp(current->label, label) == 0){
-            return current->offset;
+
+asm_symbol *asm_symbol_table_find(asm_symbol_table *table, char *name) {
+    if (table->count == 0) {
+        return NULL;
+    }
+    int bucket = asm_symbol_bucket(table, name, asm_hash_label(name));
+    return table->buckets[bucket] == -1 ? NULL : &table->symbols[table->buckets[bucket]];
+}
+
+int asm_define_label(asm_compilation_result *result, char *label, int offset) {
+    return asm_symbol_table_add(&result->arena, &result->symbols, label, offset);
+}
+
+int asm_find_label(asm_compilation_result *result, char *label) {
+    asm_symbol *symbol = asm_symbol_table_find(&result->symbols, label);
+    return symbol ? symbol->offset : -1;
+}
+
+void asm_add_relocation(asm_compilation_result *result, int slot, int import) {
+    if (result->relocation_count == result->relocation_capacity) {
+        int capacity = result->relocation_capacity ? result->relocation_capacity * 2 : 32;
+        asm_relocation *relocations = lmsm_arena_alloc(&result->arena, capacity * sizeof(asm_relocation));
+        if (result->relocation_count) {
+            memcpy(relocations, result->relocations, result->relocation_count * sizeof(asm_relocation));
         }
-        current = current->next;
+        result->relocations = relocations;
+        result->relocation_capacity = capacity;
     }
-    return -1;
+    asm_relocation *relocation = &result->relocations[result->relocation_count++];
+    relocation->slot = slot;
+    relocation->import = import;
 }
 
 
@@ -135,77 +276,103 @@ int asm_find_label(asm_instruction *root, char *label) {
 // Assembly Parsing/Scanning
 //======================================================
 
-void asm_parse_src(asm_compilation_result * result, char * original_src) {
-
-   char *src = calloc(strlen(original_src) + 1, sizeof(char));
-    strcat(src, original_src);
-    asm_instruction *last_instruction = NULL;
-    asm_instruction * current_instruction = NULL;
-
-    // [LABEL] <INST> [LABEL_REF | VALUE]
-    // INP
-    // ADD FOO
-    char *token = strtok(src, " \n");
+void asm_scanner_init(asm_scanner *scanner, const char *src, size_t length, int first_line) {
+    lmsm_lexer_init(&scanner->lexer, src, length, first_line);
+    scanner->count = 0;
+    scanner->next = 0;
+}
 
-    while (token != NULL) {
+int asm_next_token(asm_scanner *scanner, asm_token *token) {
+    if (scanner->next == scanner->count) {
+        scanner->count = lmsm_lexer_fill(&scanner->lexer, scanner->tokens, ASM_SCANNER_WINDOW);
+        scanner->next = 0;
+        if (scanner->count == 0) {
+            return 0;
+        }
+    }
+    lmsm_token *next = &scanner->tokens[scanner->next++];
+    token->start = scanner->lexer.src + next->start;
+    token->length = next->length;
+    token->line = next->line;
+    token->column = next->column;
+    token->number = next->number;
+    return 1;
+}
 
-        char *type = NULL;
-        char *label = NULL;
-        char *label_reference = NULL;
-        int value = 0;
+// parses the next instruction and links it after the predecessor, returns NULL at the end of the source
+// or after setting result->error
+asm_instruction *asm_parse_instruction(asm_compilation_result *result, asm_scanner *scanner, asm_instruction *predecessor) {
+    asm_token token;
+    if (!asm_next_token(scanner, &token)) {
+        return NULL;
+    }
+    int first_line = token.line;
+    char *label = NULL;
+    char *label_reference = NULL;
+    int value = 0;
 
-        if (asm_is_instruction(token)) { // if it's an instruction (mnemonic) it's not a label
-            type = strdup(token);
-            label = NULL;
-        } else {
-            label = strdup(token);
-            token = strtok(NULL, " \n");
-            if (token && asm_is_instruction(token)) {
-                type = strdup(token);
-            } else {
-                result->error = ASM_ERROR_UNKNOWN_INSTRUCTION;
-                break;
-            }
+    const asm_mnemonic *mnemonic = asm_find_mnemonic(token.start, token.length);
+    if (mnemonic == NULL) { // if it's not an instruction (mnemonic) it's a label
+        label = lmsm_arena_strndup(&result->arena, token.start, token.length);
+        if (asm_next_token(scanner, &token)) {
+            mnemonic = asm_find_mnemonic(token.start, token.length);
         }
+        if (mnemonic == NULL) {
+            result->error = ASM_ERROR_UNKNOWN_INSTRUCTION;
+            return NULL;
+        }
+    }
+    int line = token.line;
+    int column = token.column;
 
-        if (asm_instruction_requires_arg(type)) {
-            token = strtok(NULL, " \n");
-            if (!token) {
-                result->error = ASM_ERROR_ARG_REQUIRED;
-                break;
-            }
-            if (asm_is_num(token)) {
-                value = atoi(token);
-                if (value < -999 || value > 999) {
-                    result->error = ASM_ERROR_OUT_OF_RANGE;
-                    break;
-                }
-                label_reference = NULL;
-            } else {
-                label_reference = strdup(token);
-                value = 0;
+    if (mnemonic->requires_arg) {
+        if (!asm_next_token(scanner, &token)) {
+            result->error = ASM_ERROR_ARG_REQUIRED;
+            return NULL;
+        }
+        if (token.number) {
+            value = asm_parse_num(token.start, token.length);
+            int limit = result->address_radix * 10 - 1;
+            if (value < -limit || value > limit) {
+                result->error = ASM_ERROR_OUT_OF_RANGE;
+                return NULL;
             }
         } else {
-            label_reference = NULL;
-            value = 0;
+            label_reference = lmsm_arena_strndup(&result->arena, token.start, token.length);
         }
+    }
 
-        current_instruction = asm_make_instruction(type, label, label_reference, value,last_instruction);
+    asm_instruction *instruction = asm_make_instruction(&result->arena, mnemonic, label, label_reference, value, predecessor);
+    instruction->line = line;
+    instruction->column = column;
+    instruction->first_line = first_line;
+    instruction->last_line = token.line;
+    return instruction;
+}
 
-        if (!result->root) {
-            result->root = current_instruction;
+void asm_parse_src(asm_compilation_result * result, char * original_src) {
+
+    // tokens are slices of the source, which is never copied or modified
+    asm_scanner scanner;
+    asm_scanner_init(&scanner, original_src, strlen(original_src), 1);
+    asm_instruction *last_instruction = NULL;
+    asm_instruction * current_instruction = NULL;
+
+    // [LABEL] <INST> [LABEL_REF | VALUE]
+    // INP
+    // ADD FOO
+    while ((current_instruction = asm_parse_instruction(result, &scanner, last_instruction)) != NULL) {
+        if (current_instruction->label && !asm_define_label(result, current_instruction->label, current_instruction->offset)) {
+            result->error = ASM_ERROR_DUPLICATE_LABEL;
+            break;
         }
 
-        if (last_instruction != NULL) {
-            last_instruction->next = current_instruction;
+        if (!result->root) {
+            result->root = current_instruction;
         }
         last_instruction = current_instruction;
-
-        token = strtok(NULL, " \n");
-
     }
 
-    free(src);
         // TODO - assign the current instruction to the last instruction
 
         // TODO - check if asm_comp_result  root is null and if it is assign the current instruction to it
@@ -223,6 +390,51 @@ void asm_parse_src(asm_compilation_result * result, char * original_src) {
     //       store the error in result->error
 }
 
+//======================================================
+// Instructions From Other Front Ends
+//======================================================
+
+asm_instruction *asm_add_instruction(asm_compilation_result *result, asm_instruction *predecessor, const char *name,
+                                     char *label, const char *argument, int argument_length, int line, int column) {
+    const asm_mnemonic *mnemonic = asm_find_mnemonic(name, (int) strlen(name));
+    if (mnemonic == NULL) {
+        result->error = ASM_ERROR_UNKNOWN_INSTRUCTION;
+        return NULL;
+    }
+    char *label_reference = NULL;
+    int value = 0;
+    if (mnemonic->requires_arg) {
+        // the same checks the parser makes on an argument token
+        if (argument == NULL) {
+            result->error = ASM_ERROR_ARG_REQUIRED;
+            return NULL;
+        }
+        if (asm_is_num_slice(argument, argument_length)) {
+            value = asm_parse_num(argument, argument_length);
+            int limit = result->address_radix * 10 - 1;
+            if (value < -limit || value > limit) {
+                result->error = ASM_ERROR_OUT_OF_RANGE;
+                return NULL;
+            }
+        } else {
+            label_reference = lmsm_arena_strndup(&result->arena, argument, argument_length);
+        }
+    }
+    asm_instruction *instruction = asm_make_instruction(&result->arena, mnemonic, label, label_reference, value, predecessor);
+    instruction->line = line;
+    instruction->column = column;
+    instruction->first_line = line;
+    instruction->last_line = line;
+    if (label && !asm_define_label(result, label, instruction->offset)) {
+        result->error = ASM_ERROR_DUPLICATE_LABEL;
+        return NULL;
+    }
+    if (result->root == NULL) {
+        result->root = instruction;
+    }
+    return instruction;
+}
+
 //======================================================
 // Machine Code Generation
 //======================================================
@@ -236,8 +448,22 @@ void asm_gen_code_for_instruction(asm_compilation_result  * result, asm_instruct
     // you will need to look it up with `asm_find_label` and, if the label does not exist,
     // report the error as ASM_ERROR_BAD_LABEL
     int value_for_instruction;
-    if (instruction->label_reference != NULL){
-        value_for_instruction = asm_find_label(result->root, instruction->label_reference);
+    if (instruction->label_reference != NULL && result->relocatable) {
+        // the operand is an address the linker moves, either in this module or in the one exporting the label
+        value_for_instruction = asm_find_label(result, instruction->label_reference);
+        int import = -1;
+        if (value_for_instruction == -1) {
+            asm_symbol *symbol = asm_symbol_table_find(&result->imports, instruction->label_reference);
+            if (symbol == NULL) {
+                asm_symbol_table_add(&result->arena, &result->imports, instruction->label_reference, result->imports.count);
+                symbol = &result->imports.symbols[result->imports.count - 1];
+            }
+            import = symbol->offset;
+            value_for_instruction = 0;
+        }
+        asm_add_relocation(result, instruction->offset, import);
+    } else if (instruction->label_reference != NULL){
+        value_for_instruction = asm_find_label(result, instruction->label_reference);
         if (value_for_instruction == -1){
             result->error = ASM_ERROR_BAD_LABEL;
             return;
@@ -246,83 +472,563 @@ void asm_gen_code_for_instruction(asm_compilation_result  * result, asm_instruct
         value_for_instruction = instruction->value;
     }
 
-    if (strcmp("ADD", instruction->instruction) == 0) {
-        result->code[instruction->offset] = 100 + value_for_instruction;
-    } else if (strcmp("SUB", instruction->instruction) == 0){
-        result->code[instruction->offset] = 200 + value_for_instruction;
-    } else if (strcmp("STA", instruction->instruction) == 0){
-        result->code[instruction->offset] = 300 + value_for_instruction;
-    } else if (strcmp("LDI", instruction->instruction) == 0){
-        result->code[instruction->offset] = 400 + value_for_instruction;
-    } else if (strcmp("LDA", instruction->instruction) == 0){
-        result->code[instruction->offset] = 500 + value_for_instruction;
-    } else if (strcmp("BRA", instruction->instruction) == 0){
-        result->code[instruction->offset] = 600 + value_for_instruction;
-    } else if (strcmp("BRZ", instruction->instruction) == 0){
-        result->code[instruction->offset] = 700 + value_for_instruction;
-    } else if (strcmp("BRP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 800 + value_for_instruction;
-    } else if (strcmp("INP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 901;
-    } else if (strcmp("OUT", instruction->instruction) == 0){
-        result->code[instruction->offset] = 902;
-    } else if (strcmp("HALT", instruction->instruction) == 0){
-        result->code[instruction->offset] = 000 + value_for_instruction;
-    } else if (strcmp("SPUSH", instruction->instruction) == 0){
-        result->code[instruction->offset] = 920;
-    } else if (strcmp("SPOP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 921;
-    } else if (strcmp("SDUP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 922;
-    } else if (strcmp("SDROP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 923;
-    } else if (strcmp("SSWAP", instruction->instruction) == 0){
-        result->code[instruction->offset] = 924;
-    } else if (strcmp("SADD", instruction->instruction) == 0){
-        result->code[instruction->offset] = 930;
-    } else if (strcmp("SSUB", instruction->instruction) == 0){
-        result->code[instruction->offset] = 931;
-    } else if (strcmp("SMUL", instruction->instruction) == 0){
-        result->code[instruction->offset] = 932;
-    } else if (strcmp("SDIV", instruction->instruction) == 0){
-        result->code[instruction->offset] = 933;
-    } else if (strcmp("SMAX", instruction->instruction) == 0){
-        result->code[instruction->offset] = 934;
-    } else if (strcmp("SMIN", instruction->instruction) == 0){
-        result->code[instruction->offset] = 935;
-    } else if (strcmp("JAL", instruction->instruction) == 0){
-        result->code[instruction->offset] = 910;
-    } else if (strcmp("RET", instruction->instruction) == 0){
-        result->code[instruction->offset] = 911;
-    } else if (strcmp("SPUSHI", instruction->instruction) == 0){
-            result->code[instruction->offset] = 400 + value_for_instruction;
-            result->code[instruction->offset+1] = 920 + value_for_instruction - 1;
-    } else if (strcmp("DAT", instruction->instruction) == 0){
-        result->code[instruction->offset] = 001 +  value_for_instruction -1;
-    } else if (strcmp("CALL", instruction->instruction) == 0){
-        result->code[instruction->offset] = 400 + value_for_instruction;
-        result->code[instruction->offset+1] = 920 + value_for_instruction -1;
-        result->code[instruction->offset+2] = 910 + value_for_instruction - 1;
-    } else {
-        result->code[instruction->offset] = 0;
+    // every argument but a DAT's is an address or an LDI value, both of which fit the address digits
+    const asm_mnemonic *mnemonic = instruction->mnemonic;
+    int radix = result->address_radix;
+    if (mnemonic->requires_arg && mnemonic->words[0].opcode != ASM_RAW_WORD &&
+        (value_for_instruction < 0 || value_for_instruction >= radix)) {
+        result->error = ASM_ERROR_OUT_OF_RANGE;
+        return;
+    }
+
+    for (int slot = 0; slot < mnemonic->slots; ++slot) {
+        const asm_word_template *word = &mnemonic->words[slot];
+        int operand = word->operand == ASM_ARGUMENT ? value_for_instruction : word->operand;
+        if (word->opcode == ASM_RAW_WORD) {
+            result->code[instruction->offset + slot] = value_for_instruction;
+        } else {
+            result->code[instruction->offset + slot] = word->opcode * radix + operand;
+        }
+    }
+
+    for (int slot = 0; slot < instruction->slots; ++slot) {
+        result->source_map[instruction->offset + slot].line = instruction->line;
+        result->source_map[instruction->offset + slot].column = instruction->column;
     }
 
 }
 
 void asm_gen_code(asm_compilation_result * result) {
     asm_instruction * current = result->root;
-    while (current != NULL) {
+    while (current != NULL && current->next != NULL) {
+        current = current->next;
+    }
+    if (current != NULL && current->offset + current->slots > result->code_size) {
+        result->error = ASM_ERROR_PROGRAM_TOO_LARGE;
+        return;
+    }
+    current = result->root;
+    while (current != NULL && result->error == NULL) {
         asm_gen_code_for_instruction(result, current);
         current = current->next;
     }
 }
 
+//======================================================
+// Peephole Optimisation
+//======================================================
+
+int asm_is(asm_instruction *instruction, char *name) {
+    return instruction != NULL && strcmp(instruction->instruction, name) == 0;
+}
+
+// a replacement instruction standing in for the source of the one it replaces
+asm_instruction *asm_make_replacement(asm_compilation_result *result, char *name, int value, asm_instruction *original) {
+    asm_instruction *replacement = asm_make_instruction(&result->arena, asm_find_mnemonic(name, (int) strlen(name)),
+                                                        NULL, NULL, value, NULL);
+    replacement->line = original->line;
+    replacement->column = original->column;
+    replacement->first_line = original->first_line;
+    replacement->last_line = original->last_line;
+    return replacement;
+}
+
+// LDI x; SPUSH or SPUSHI x with a numeric x, returns the instruction after it or NULL if there is none here
+asm_instruction *asm_constant_push(asm_instruction *instruction, int *value) {
+    if (instruction == NULL || instruction->label_reference != NULL) {
+        return NULL;
+    } else if (asm_is(instruction, "SPUSHI")) {
+        *value = instruction->value;
+        return instruction->next;
+    } else if (asm_is(instruction, "LDI") && asm_is(instruction->next, "SPUSH") && instruction->next->label == NULL) {
+        *value = instruction->value;
+        return instruction->next->next;
+    }
+    return NULL;
+}
+
+// what the machine pushes for second <op> first, capped as the stack instructions cap it, 0 if it cannot be folded
+int asm_fold(asm_instruction *op, int second, int first, int limit, int *value) {
+    if (asm_is(op, "SADD")) {
+        *value = second + first >= limit ? limit : second + first;
+    } else if (asm_is(op, "SSUB")) {
+        *value = second - first <= -limit ? -limit : second - first;
+    } else if (asm_is(op, "SMUL")) {
+        *value = second * first >= limit ? limit : second * first;
+    } else if (asm_is(op, "SDIV") && first != 0) {
+        *value = second / first >= limit ? limit : second / first;
+    } else if (asm_is(op, "SMAX")) {
+        *value = first > second ? first : second;
+    } else if (asm_is(op, "SMIN")) {
+        *value = first > second ? second : first;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// instructions that replace the accumulator without reading it
+int asm_sets_accumulator(asm_instruction *instruction) {
+    return asm_is(instruction, "LDI") || asm_is(instruction, "LDA") || asm_is(instruction, "SPUSHI") ||
+           asm_is(instruction, "CALL") || asm_is(instruction, "INP") || asm_is(instruction, "SPOP");
+}
+
+int asm_is_address_instruction(asm_instruction *instruction) {
+    return asm_is(instruction, "ADD") || asm_is(instruction, "SUB") || asm_is(instruction, "LDA") ||
+           asm_is(instruction, "STA") || asm_is(instruction, "BRA") || asm_is(instruction, "BRZ") ||
+           asm_is(instruction, "BRP") || asm_is(instruction, "CALL");
+}
+
+void asm_layout(asm_compilation_result *result, asm_instruction **at_offset) {
+    int offset = 0;
+    for (asm_instruction *current = result->root; current != NULL; current = current->next) {
+        current->offset = offset;
+        offset += current->slots;
+        if (at_offset && current->offset < result->code_size) {
+            at_offset[current->offset] = current;
+        }
+    }
+}
+
+asm_instruction *asm_labelled(asm_compilation_result *result, asm_instruction **at_offset, char *label) {
+    int offset = asm_find_label(result, label);
+    return 0 <= offset && offset < result->code_size ? at_offset[offset] : NULL;
+}
+
+// numeric addresses, computed jumps or code read and written as data all depend on the exact layout
+int asm_can_optimize(asm_compilation_result *result, asm_instruction **at_offset) {
+    for (asm_instruction *current = result->root; current != NULL; current = current->next) {
+        if (asm_is(current, "JAL") || (asm_is_address_instruction(current) && current->label_reference == NULL)) {
+            return 0;
+        }
+        if ((asm_is(current, "ADD") || asm_is(current, "SUB") || asm_is(current, "LDA") || asm_is(current, "STA"))) {
+            asm_instruction *target = asm_labelled(result, at_offset, current->label_reference);
+            if (target == NULL || !asm_is(target, "DAT")) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// one pass over the list, returns 1 if anything was rewritten
+int asm_peephole(asm_compilation_result *result, asm_instruction **at_offset) {
+    int changed = 0;
+    int limit = result->address_radix * 10 - 1;
+    asm_instruction **link = &result->root;
+    while (*link != NULL) {
+        asm_instruction *current = *link;
+        asm_instruction *next = current->next;
+        int first;
+        int second;
+        int folded;
+        asm_instruction *after_first = asm_constant_push(current, &second);
+        asm_instruction *after_second = after_first && after_first->label == NULL ? asm_constant_push(after_first, &first) : NULL;
+
+        if (asm_is(current, "SPUSH") && current->label == NULL && asm_is(next, "SPOP") && next->label == NULL) {
+            // SPUSH; SPOP leaves the accumulator and the stack as they were
+            *link = next->next;
+            changed = 1;
+            continue;
+        } else if (asm_is(current, "SPUSHI") && asm_is(next, "SPOP") && next->label == NULL) {
+            asm_instruction *load = asm_make_replacement(result, "LDI", current->value, current);
+            load->label = current->label;
+            load->label_reference = current->label_reference;
+            load->next = next->next;
+            *link = load;
+            changed = 1;
+        } else if (after_second && after_second->label == NULL &&
+                   asm_fold(after_second, second, first, limit, &folded) && 0 <= folded && folded < result->address_radix) {
+            // the stack instructions put the accumulator back, so the second constant is left in it
+            asm_instruction *load = asm_make_replacement(result, "LDI", folded, current);
+            asm_instruction *push = asm_make_replacement(result, "SPUSH", 0, current);
+            load->label = current->label;
+            load->next = push;
+            if (asm_sets_accumulator(after_second->next)) {
+                push->next = after_second->next;
+            } else {
+                push->next = asm_make_replacement(result, "LDI", first, after_first);
+                push->next->next = after_second->next;
+            }
+            *link = load;
+            changed = 1;
+            continue;
+        } else if ((asm_is(current, "BRA") || asm_is(current, "BRZ") || asm_is(current, "BRP")) && current->label_reference) {
+            // jump straight to where a chain of BRAs ends up
+            asm_instruction *target = asm_labelled(result, at_offset, current->label_reference);
+            for (int hops = 0; asm_is(target, "BRA") && target->label_reference && hops < 100; ++hops) {
+                if (strcmp(target->label_reference, current->label_reference) == 0) {
+                    break;
+                }
+                current->label_reference = target->label_reference;
+                target = asm_labelled(result, at_offset, current->label_reference);
+                changed = 1;
+            }
+            if (asm_is(current, "BRA") && current->label == NULL && target != NULL && target == next) {
+                *link = next;
+                changed = 1;
+                continue;
+            }
+        }
+
+        current = *link;
+        if (asm_is(current, "HLT") || asm_is(current, "COB") || asm_is(current, "BRA") || asm_is(current, "RET")) {
+            // nothing falls into what follows, so up to the next label only data is worth keeping
+            asm_instruction **tail = &current->next;
+            while (*tail != NULL && (*tail)->label == NULL) {
+                if (asm_is(*tail, "DAT")) {
+                    tail = &(*tail)->next;
+                } else {
+                    *tail = (*tail)->next;
+                    changed = 1;
+                }
+            }
+        }
+        link = &current->next;
+    }
+    return changed;
+}
+
+int asm_optimize(asm_compilation_result *result) {
+    if (result->error || result->root == NULL) {
+        return 0;
+    }
+    asm_instruction **at_offset = calloc(result->code_size, sizeof(asm_instruction *));
+    asm_layout(result, at_offset);
+    asm_instruction *last = result->root;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    int original_end = last->offset + last->slots;
+    int new_end = original_end;
+
+    if (original_end <= result->code_size && asm_can_optimize(result, at_offset)) {
+        for (int pass = 0; pass < 10 && asm_peephole(result, at_offset); ++pass) {
+            memset(at_offset, 0, result->code_size * sizeof(asm_instruction *));
+            asm_layout(result, NULL);
+            for (asm_instruction *current = result->root; current != NULL; current = current->next) {
+                if (current->label) {
+                    asm_symbol_table_find(&result->symbols, current->label)->offset = current->offset;
+                }
+                if (current->offset < result->code_size) {
+                    at_offset[current->offset] = current;
+                }
+                new_end = current->offset + current->slots;
+            }
+        }
+    }
+    free(at_offset);
+    return original_end - new_end;
+}
+
+//======================================================
+// Incremental Re-assembly
+//======================================================
+
+int asm_count_lines(char *start, char *end) {
+    int lines = 0;
+    for (char *c = start; c < end; ++c) {
+        lines += *c == '\n';
+    }
+    return lines;
+}
+
+// regenerates the code of one instruction, recording each slot that changed
+int asm_regenerate(asm_compilation_result *result, asm_instruction *instruction, int *changed_slots, int *changed_count) {
+    int previous[3];
+    memcpy(previous, result->code + instruction->offset, sizeof(int) * instruction->slots);
+    asm_gen_code_for_instruction(result, instruction);
+    if (result->error) {
+        return 0;
+    }
+    for (int slot = 0; slot < instruction->slots; ++slot) {
+        if (result->code[instruction->offset + slot] != previous[slot]) {
+            changed_slots[(*changed_count)++] = instruction->offset + slot;
+        }
+    }
+    return 1;
+}
+
+int asm_reassemble(asm_compilation_result *result, char *old_src, char *new_src, int *changed_slots, int *changed_count) {
+    *changed_count = 0;
+    if (result->error || result->relocatable || result->optimized) {
+        return 0;
+    }
+
+    // the whole lines both sources start with...
+    size_t prefix = 0;
+    int first_line = 1;
+    size_t i = 0;
+    while (old_src[i] != '\0' && old_src[i] == new_src[i]) {
+        if (old_src[i++] == '\n') {
+            prefix = i;
+            first_line++;
+        }
+    }
+    if (old_src[i] == new_src[i]) {
+        return 1;
+    }
+
+    // ...and end with, without overlapping the prefix
+    size_t old_length = strlen(old_src);
+    size_t new_length = strlen(new_src);
+    size_t common = 0;
+    while (common < old_length - prefix && common < new_length - prefix &&
+           old_src[old_length - 1 - common] == new_src[new_length - 1 - common]) {
+        common++;
+    }
+    size_t suffix = old_length - common + 1;
+    while (suffix <= old_length && old_src[suffix - 1] != '\n') {
+        suffix++;
+    }
+    int has_suffix = suffix <= old_length;
+    if (!has_suffix) {
+        suffix = old_length;
+    }
+    size_t new_suffix = suffix + new_length - old_length;
+    int old_last = first_line + asm_count_lines(old_src + prefix, old_src + suffix) - has_suffix;
+    int new_last = first_line + asm_count_lines(new_src + prefix, new_src + new_suffix) - has_suffix;
+    int delta = new_last - old_last;
+
+    // the instructions with a token on a changed line, widened to whole instructions
+    asm_instruction *previous = NULL;
+    asm_instruction *current = result->root;
+    while (current != NULL && current->last_line < first_line) {
+        previous = current;
+        current = current->next;
+    }
+    asm_instruction *first_old = current;
+    int region_first = current != NULL && current->first_line < first_line ? current->first_line : first_line;
+    int region_last = old_last;
+    int old_slots = 0;
+    while (current != NULL && current->first_line <= old_last) {
+        old_slots += current->slots;
+        if (current->last_line > region_last) {
+            region_last = current->last_line;
+        }
+        current = current->next;
+    }
+    asm_instruction *next = current;
+    if ((previous != NULL && previous->last_line >= region_first) || (next != NULL && next->first_line <= region_last)) {
+        return 0; // an unchanged instruction shares a line with the region, which is re-parsed whole
+    }
+    region_last += delta;
+
+    // re-parse just those lines of the new source
+    char *start = new_src + prefix;
+    for (int line = first_line; line > region_first; --line) {
+        do {
+            start--;
+        } while (start > new_src && start[-1] != '\n');
+    }
+    char *end = new_src + prefix;
+    for (int line = first_line; line <= region_last && *end != '\0'; ++end) {
+        line += *end == '\n';
+    }
+    asm_scanner scanner;
+    asm_scanner_init(&scanner, start, end - start, region_first);
+    asm_instruction *first_new = NULL;
+    asm_instruction *last_new = previous;
+    int new_slots = 0;
+    while ((current = asm_parse_instruction(result, &scanner, last_new)) != NULL) {
+        if (first_new == NULL) {
+            first_new = current;
+        }
+        new_slots += current->slots;
+        last_new = current;
+    }
+    if (result->error) {
+        return 0;
+    }
+
+    // labels keep their symbols when the region defines the same ones at the same slots
+    int labels_same = 1;
+    int labels_moved = new_slots != old_slots;
+    asm_instruction *old_instruction = first_old;
+    asm_instruction *new_instruction = first_new;
+    while (labels_same && (old_instruction != next || new_instruction != NULL)) {
+        while (old_instruction != next && old_instruction->label == NULL) {
+            old_instruction = old_instruction->next;
+        }
+        while (new_instruction != NULL && new_instruction->label == NULL) {
+            new_instruction = new_instruction == last_new ? NULL : new_instruction->next;
+        }
+        if (old_instruction == next || new_instruction == NULL) {
+            labels_same = old_instruction == next && new_instruction == NULL;
+        } else if (strcmp(old_instruction->label, new_instruction->label) != 0) {
+            labels_same = 0;
+        } else {
+            labels_moved |= old_instruction->offset != new_instruction->offset;
+            old_instruction = old_instruction->next;
+            new_instruction = new_instruction == last_new ? NULL : new_instruction->next;
+        }
+    }
+    labels_moved |= !labels_same;
+
+    // splice the region in
+    if (last_new != NULL) {
+        last_new->next = next;
+    }
+    if (previous == NULL) {
+        result->root = first_new != NULL ? first_new : next;
+    }
+
+    // everything after the region keeps its code unless the slot count changed
+    int new_end = last_new != NULL ? last_new->offset + last_new->slots : 0;
+    int old_end = new_end;
+    if (delta != 0 || new_slots != old_slots) {
+        for (current = next; current != NULL; current = current->next) {
+            current->line += delta;
+            current->first_line += delta;
+            current->last_line += delta;
+            current->offset += new_slots - old_slots;
+            if (new_slots == old_slots) {
+                for (int slot = 0; slot < current->slots; ++slot) {
+                    result->source_map[current->offset + slot].line = current->line;
+                }
+            }
+            new_end = current->offset + current->slots;
+        }
+        old_end = new_end - (new_slots - old_slots);
+        if (new_end > result->code_size) {
+            result->error = ASM_ERROR_PROGRAM_TOO_LARGE;
+            return 0;
+        }
+    }
+
+    if (!labels_same) {
+        result->symbols = (asm_symbol_table) {0};
+        for (current = result->root; current != NULL; current = current->next) {
+            if (current->label && !asm_define_label(result, current->label, current->offset)) {
+                result->error = ASM_ERROR_DUPLICATE_LABEL;
+                return 0;
+            }
+        }
+    } else if (labels_moved) {
+        int moved = 0;
+        for (current = first_new != NULL ? first_new : next; current != NULL; current = current->next) {
+            moved |= current == next;
+            if (moved && new_slots == old_slots) {
+                break;
+            }
+            if (current->label) {
+                asm_symbol_table_find(&result->symbols, current->label)->offset = current->offset;
+            }
+        }
+    }
+
+    // re-emit the region, anything that moved and, if a label moved, everything that names one
+    int in_region = 0;
+    int after_region = 0;
+    current = labels_moved ? result->root : (first_new != NULL ? first_new : next);
+    for (; current != NULL; current = current->next) {
+        in_region |= current == first_new;
+        after_region |= current == next;
+        if (after_region && !labels_moved) {
+            break;
+        }
+        int moved = after_region && new_slots != old_slots;
+        if (((in_region && !after_region) || moved || current->label_reference) &&
+            !asm_regenerate(result, current, changed_slots, changed_count)) {
+            return 0;
+        }
+    }
+    for (int slot = new_end; slot < old_end; ++slot) {
+        if (result->code[slot] != 0) {
+            result->code[slot] = 0;
+            changed_slots[(*changed_count)++] = slot;
+        }
+        result->source_map[slot] = (asm_source_location) {0, 0};
+    }
+    return 1;
+}
+
+//======================================================
+// Disassembly
+//======================================================
+
+void asm_disassemble(int machine_code, int address_radix, char *buffer) {
+    const char *ADDRESS_INSTRUCTIONS[9] = {NULL, "ADD", "SUB", "STA", "LDI", "LDA", "BRA", "BRZ", "BRP"};
+    int opcode = machine_code / address_radix;
+    int operand = machine_code % address_radix;
+    if (machine_code == 0) {
+        sprintf(buffer, "HLT");
+    } else if (1 <= opcode && opcode <= 8) {
+        sprintf(buffer, "%s %d", ADDRESS_INSTRUCTIONS[opcode], operand);
+    } else if (opcode != 9) {
+        sprintf(buffer, "DAT %d", machine_code);
+    } else if (operand == 1) {
+        sprintf(buffer, "INP");
+    } else if (operand == 2) {
+        sprintf(buffer, "OUT");
+    } else if (operand == 10) {
+        sprintf(buffer, "JAL");
+    } else if (operand == 11) {
+        sprintf(buffer, "RET");
+    } else if (operand == 20) {
+        sprintf(buffer, "SPUSH");
+    } else if (operand == 21) {
+        sprintf(buffer, "SPOP");
+    } else if (operand == 22) {
+        sprintf(buffer, "SDUP");
+    } else if (operand == 23) {
+        sprintf(buffer, "SDROP");
+    } else if (operand == 24) {
+        sprintf(buffer, "SSWAP");
+    } else if (operand == 30) {
+        sprintf(buffer, "SADD");
+    } else if (operand == 31) {
+        sprintf(buffer, "SSUB");
+    } else if (operand == 32) {
+        sprintf(buffer, "SMUL");
+    } else if (operand == 33) {
+        sprintf(buffer, "SDIV");
+    } else if (operand == 34) {
+        sprintf(buffer, "SMAX");
+    } else if (operand == 35) {
+        sprintf(buffer, "SMIN");
+    } else {
+        sprintf(buffer, "DAT %d", machine_code);
+    }
+}
+
 //======================================================
 // Main API
 //======================================================
 
 asm_compilation_result * asm_assemble(char *src) {
-    asm_compilation_result * result = asm_make_compilation_result();
+    return asm_assemble_for(src, CODE_SIZE, ADDRESS_RADIX);
+}
+
+asm_compilation_result * asm_assemble_for(char *src, int code_size, int address_radix) {
+    asm_compilation_result * result = asm_make_sized_compilation_result(code_size, address_radix);
+    asm_parse_src(result, src);
+    asm_gen_code(result);
+    return result;
+}
+
+asm_compilation_result * asm_assemble_optimized(char *src, int code_size, int address_radix) {
+    asm_compilation_result * result = asm_make_sized_compilation_result(code_size, address_radix);
+    asm_parse_src(result, src);
+    result->optimized = 1;
+    asm_optimize(result);
+    asm_gen_code(result);
+    return result;
+}
+
+void asm_assemble_instructions(asm_compilation_result *result) {
+    if (result->error) {
+        return;
+    }
+    if (result->optimized) {
+        asm_optimize(result);
+    }
+    asm_gen_code(result);
+}
+
+asm_compilation_result * asm_assemble_module(char *src, int code_size, int address_radix) {
+    asm_compilation_result * result = asm_make_sized_compilation_result(code_size, address_radix);
+    result->relocatable = 1;
     asm_parse_src(result, src);
     asm_gen_code(result);
     return result;
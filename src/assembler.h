@@ -1,55 +1,208 @@
 #ifndef LMSM_ASSEMBLER_H
 #define LMSM_ASSEMBLER_H
 
+#include "arena.h"
+#include "lexer.h"
+
 //===================================================================
 //  Error messages
 //===================================================================
 extern char *ASM_ERROR_UNKNOWN_INSTRUCTION;
 extern char *ASM_ERROR_ARG_REQUIRED;
 extern char *ASM_ERROR_BAD_LABEL;
+extern char *ASM_ERROR_DUPLICATE_LABEL;
 extern char *ASM_ERROR_OUT_OF_RANGE;
+extern char *ASM_ERROR_PROGRAM_TOO_LARGE;
+
+//===================================================================
+//  Describes a mnemonic and the machine words it assembles to
+//===================================================================
+
+#define ASM_ARGUMENT (-1)   // a word operand that comes from the instruction's argument
+#define ASM_RAW_WORD (-1)   // a word opcode for DAT, the argument is the whole word
+
+typedef struct asm_word_template {
+    int opcode;             // the word is opcode * address_radix + operand
+    int operand;
+} asm_word_template;
+
+typedef struct asm_mnemonic {
+    const char *name;
+    int requires_arg;
+    int slots;
+    asm_word_template words[3];   // one per slot, pseudo instructions expand to several
+} asm_mnemonic;
 
 //===================================================================
 //  Represents an asm_instruction for the LMSM architecture
 //===================================================================
 
 typedef struct asm_instruction {
-    char* instruction;         // the Mnemonics of the asm_instruction
+    char* instruction;         // the Mnemonics of the asm_instruction, the name of the descriptor below
+    const asm_mnemonic *mnemonic;
     char* label;               // the label of the asm_instruction - the label that allows you to jump
     char* label_reference;     // the right hand side of calling a label that allows for function calls and recursion
     int value;                 // add 5 - meaning i want you to add five to whatever is in the accumulator - exclusive from label_reference
     int slots;                // number of places an instruction in memory takes up
     int offset;                // the offset of the asm_instruction, if any
+    int line;                  // source line of the mnemonic, starting at 1
+    int column;                // source column of the mnemonic, starting at 1
+    int first_line;            // source lines of the first (label or mnemonic) and last token
+    int last_line;
     struct asm_instruction * next; // the next asm_instruction
 } asm_instruction;
 
+//===================================================================
+//  A position in the assembly source, line 0 means no source
+//===================================================================
+typedef struct asm_source_location {
+    int line;
+    int column;
+} asm_source_location;
+
+//===================================================================
+//  A token of assembly source, a slice of the (unmodified) source
+//===================================================================
+typedef struct asm_token {
+    const char *start;
+    int length;
+    int line;
+    int column;
+    int number;
+} asm_token;
+
+//===================================================================
+//  Tokenizer state, one per parse so parses can run in parallel
+//===================================================================
+#define ASM_SCANNER_WINDOW 256
+
+typedef struct asm_scanner {
+    lmsm_lexer lexer;
+    lmsm_token tokens[ASM_SCANNER_WINDOW];   // the window of tokens being parsed
+    int count;
+    int next;
+} asm_scanner;
+
+//===================================================================
+//  Labels defined by a program, in definition order, with an open
+//  addressing hash index over them
+//===================================================================
+typedef struct asm_symbol {
+    char *name;
+    int offset;                // the code slot the label names
+    unsigned int hash;
+} asm_symbol;
+
+typedef struct asm_symbol_table {
+    asm_symbol *symbols;
+    int count;
+    int capacity;
+    int *buckets;              // index into symbols, -1 when empty
+    int bucket_count;          // a power of two, kept at least twice count
+} asm_symbol_table;
+
+//===================================================================
+//  A code slot whose operand is an address, which the linker adjusts
+//  when it moves the module or resolves the import
+//===================================================================
+typedef struct asm_relocation {
+    int slot;
+    int import;                // index into the imports, -1 for a label in the same module
+} asm_relocation;
+
 //===================================================================
 //  The result of an assembly compilation
 //===================================================================
 typedef struct asm_compilation_result {
+    lmsm_arena arena;    // owns the instructions, their strings and the code below
     char* error;         // any error that occurred (e.g. a missing label)
     asm_instruction *root;   // the root asm_instruction of the compilation
-    int code[100];       // the machine code generated by the assembler
+    asm_symbol_table symbols;  // every label, built while parsing
+    int optimized;             // set by asm_assemble_optimized, the instructions no longer match the source
+    int relocatable;           // set by asm_assemble_module, which records the fields below
+    asm_symbol_table imports;  // labels used but not defined, the offset of each is its import index
+    asm_relocation *relocations;
+    int relocation_count;
+    int relocation_capacity;
+    int *code;           // the machine code generated by the assembler
+    asm_source_location *source_map; // the source location that generated each code slot
+    int code_size;       // slots of code, 100 in the classic layout
+    int address_radix;   // instruction words are opcode * address_radix + operand
 } asm_compilation_result;
 
 //===================================================================
 //  API
 //===================================================================
 
-asm_instruction * asm_make_instruction(char* type, char *label, char *label_reference, int value, asm_instruction * predecessor);
-void asm_delete_instruction(asm_instruction *instruction);
+asm_instruction * asm_make_instruction(lmsm_arena *arena, const asm_mnemonic *mnemonic, char *label, char *label_reference, int value, asm_instruction * predecessor);
 
+// a result for the classic layout, 100 slots of 2 digit addresses
 asm_compilation_result *asm_make_compilation_result();
 void asm_delete_compilation_result(asm_compilation_result *result);
 
+// an empty result for code_size slots, for a front end that builds the instructions itself
+asm_compilation_result *asm_make_sized_compilation_result(int code_size, int address_radix);
+
+// appends an instruction after the predecessor as if it had been parsed from "[label] name [argument]" on the
+// given line, defining its label, returns NULL after setting result->error
+asm_instruction *asm_add_instruction(asm_compilation_result *result, asm_instruction *predecessor, const char *name,
+                                     char *label, const char *argument, int argument_length, int line, int column);
+
+// generates the code for the instructions of a result, optimising them first if result->optimized is set
+void asm_assemble_instructions(asm_compilation_result *result);
+
+// scans length chars of src, numbering lines from first_line
+void asm_scanner_init(asm_scanner *scanner, const char *src, size_t length, int first_line);
+
+// reads the next whitespace separated token, returns 0 at the end of the source
+int asm_next_token(asm_scanner *scanner, asm_token *token);
+
 void asm_parse_src(asm_compilation_result *result, char *original_src);
 
 void asm_gen_code_for_instruction(asm_compilation_result  * result, asm_instruction *instruction);
 
 asm_compilation_result * asm_assemble(char * src);
 
+// assembles for a machine with code_size slots of code, e.g. one made by lmsm_create_wide
+asm_compilation_result * asm_assemble_for(char * src, int code_size, int address_radix);
+
+// assembles with the peephole optimiser run between parsing and code generation
+asm_compilation_result * asm_assemble_optimized(char * src, int code_size, int address_radix);
+
+// rewrites wasteful sequences in the parsed instruction list (pushes popped straight back, stack arithmetic on
+// constants, branches to branches and unreachable code), keeping every label, returns the slots saved
+int asm_optimize(asm_compilation_result *result);
+
+// assembles a module for the linker, labels it does not define become imports rather than errors
+// and every label operand gets a relocation
+asm_compilation_result * asm_assemble_module(char * src, int code_size, int address_radix);
+
+// updates a result assembled from old_src to match new_src, re-parsing only the changed lines and re-emitting only
+// what they affect, then fills changed_slots (code_size entries) with the slots whose code changed,
+// returns 0 if the result could not be updated and must be reassembled from scratch
+int asm_reassemble(asm_compilation_result *result, char *old_src, char *new_src, int *changed_slots, int *changed_count);
+
+// adds a label for the code slot, returns 0 if the label is already defined
+int asm_define_label(asm_compilation_result *result, char *label, int offset);
+
+// the code slot of a label, -1 if the program does not define it
+int asm_find_label(asm_compilation_result *result, char *label);
+
+// adds a name to a symbol table, returns 0 if it is already there
+int asm_symbol_table_add(lmsm_arena *arena, asm_symbol_table *table, char *name, int offset);
+
+// the symbol with the name, NULL if there is none
+asm_symbol *asm_symbol_table_find(asm_symbol_table *table, char *name);
+
 int asm_is_instruction(char * token);
+
+// the descriptor of a mnemonic, NULL if the slice is not one
+const asm_mnemonic *asm_find_mnemonic(const char *start, int length);
+
+// writes the assembly for a machine code word into buffer (at least 20 chars)
+void asm_disassemble(int machine_code, int address_radix, char *buffer);
 int asm_is_num(char * token);
+int asm_is_num_slice(const char *start, int length);
 
 void asm_delete_compilation_result(asm_compilation_result *result);
 
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "batch.h"
+#include "linker.h"
+#include "object.h"
+#include "source.h"
+
+//======================================================
+// Inputs
+//======================================================
+
+void lmsm_batch_add_job(lmsm_batch *batch, char *source) {
+    if (batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->jobs = realloc(batch->jobs, batch->capacity * sizeof(lmsm_batch_job));
+    }
+    lmsm_batch_job *job = &batch->jobs[batch->count++];
+    memset(job, 0, sizeof(lmsm_batch_job));
+    job->source = strdup(source);
+    job->object = lmsm_linker_object_path(source);
+    struct stat info;
+    job->size = stat(source, &info) == 0 ? (long) info.st_size : 0;
+}
+
+int lmsm_batch_is_source(char *name) {
+    size_t length = strlen(name);
+    return (length > strlen(".asm") && strcmp(name + length - strlen(".asm"), ".asm") == 0) ||
+           (length > strlen(".firth") && strcmp(name + length - strlen(".firth"), ".firth") == 0);
+}
+
+int lmsm_batch_compare_names(const void *first, const void *second) {
+    return strcmp(*(char **) first, *(char **) second);
+}
+
+int lmsm_batch_add_directory(lmsm_batch *batch, char *path) {
+    DIR *directory = opendir(path);
+    if (directory == NULL) {
+        return 0;
+    }
+    // sorted, so the summary reads the same on every run
+    char **names = NULL;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(directory)) != NULL) {
+        if (lmsm_batch_is_source(entry->d_name)) {
+            names = realloc(names, (count + 1) * sizeof(char *));
+            names[count] = malloc(strlen(path) + strlen(entry->d_name) + 2);
+            sprintf(names[count++], "%s/%s", path, entry->d_name);
+        }
+    }
+    closedir(directory);
+    qsort(names, count, sizeof(char *), lmsm_batch_compare_names);
+    for (int i = 0; i < count; ++i) {
+        lmsm_batch_add_job(batch, names[i]);
+        free(names[i]);
+    }
+    free(names);
+    return 1;
+}
+
+int lmsm_batch_add_manifest(lmsm_batch *batch, char *path) {
+    FILE *manifest = fopen(path, "r");
+    if (manifest == NULL) {
+        return 0;
+    }
+    char line[1000];
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        size_t length = strlen(line);
+        while (length > 0 && strchr(" \t\r\n", line[length - 1])) {
+            line[--length] = '\0';
+        }
+        char *start = line + strspn(line, " \t");
+        if (*start != '\0' && *start != '#') {
+            lmsm_batch_add_job(batch, start);
+        }
+    }
+    fclose(manifest);
+    return 1;
+}
+
+int lmsm_batch_add(lmsm_batch *batch, char *path) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return 0;
+    }
+    return S_ISDIR(info.st_mode) ? lmsm_batch_add_directory(batch, path) : lmsm_batch_add_manifest(batch, path);
+}
+
+//======================================================
+// Building
+//======================================================
+
+// whether the object beside the source was built from this exact source for this layout
+int lmsm_batch_is_unchanged(lmsm_batch *batch, lmsm_batch_job *job, unsigned long long source_hash) {
+    lmsm_object *object = lmsm_object_open(job->object);
+    if (object == NULL) {
+        return 0;
+    }
+    lmsm_object_header *header = object->header;
+    int unchanged = (header->flags & OBJECT_RELOCATABLE) &&
+                    header->address_radix == (unsigned int) batch->address_radix &&
+                    header->memory_size == (unsigned int) batch->code_size * 2 &&
+                    lmsm_object_source_hash(object) == source_hash;
+    if (unchanged) {
+        job->slots = (int) header->code_length;
+        job->imports = (int) header->import_count;
+    }
+    lmsm_object_close(object);
+    return unchanged;
+}
+
+void lmsm_batch_build(lmsm_batch *batch, lmsm_linker *linker, lmsm_batch_job *job) {
+    lmsm_source *source = lmsm_source_open(job->source);
+    if (source == NULL) {
+        snprintf(job->error, BATCH_ERROR_SIZE, "Unknown file: '%s'", job->source);
+        job->status = BATCH_FAILED;
+        return;
+    }
+    unsigned long long source_hash = lmsm_object_hash(source->text, source->length);
+    if (lmsm_batch_is_unchanged(batch, job, source_hash)) {
+        // keep the object newer than the source, so the linker goes on trusting it
+        utimes(job->object, NULL);
+        job->status = BATCH_UNCHANGED;
+        lmsm_source_close(source);
+        return;
+    }
+
+    asm_compilation_result *result = lmsm_linker_assemble(linker, source->text, job->source);
+    lmsm_source_close(source);
+    if (result == NULL) {
+        snprintf(job->error, BATCH_ERROR_SIZE, "%s", linker->error);
+        job->status = BATCH_FAILED;
+        return;
+    }
+    job->slots = lmsm_object_code_length(result);
+    job->imports = result->imports.count;
+    if (lmsm_object_write(result, 1, source_hash, job->object)) {
+        job->status = BATCH_BUILT;
+    } else {
+        snprintf(job->error, BATCH_ERROR_SIZE, "Unable to write: '%s'", job->object);
+        job->status = BATCH_FAILED;
+    }
+    asm_delete_compilation_result(result);
+}
+
+void *lmsm_batch_worker(void *argument) {
+    lmsm_batch *batch = argument;
+    // assembling only reads the layout from the linker, the error buffer is this thread's own
+    lmsm_linker *linker = lmsm_linker_create(batch->code_size, batch->address_radix);
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        int next = batch->next < batch->count ? batch->schedule[batch->next++] : -1;
+        pthread_mutex_unlock(&batch->lock);
+        if (next == -1) {
+            break;
+        }
+        lmsm_batch_build(batch, linker, &batch->jobs[next]);
+    }
+    lmsm_linker_delete(linker);
+    return NULL;
+}
+
+int lmsm_batch_compare_sizes(const void *first, const void *second) {
+    lmsm_batch_job *first_job = *(lmsm_batch_job **) first;
+    lmsm_batch_job *second_job = *(lmsm_batch_job **) second;
+    if (first_job->size != second_job->size) {
+        return first_job->size < second_job->size ? 1 : -1;
+    }
+    return first_job < second_job ? -1 : 1;
+}
+
+void lmsm_batch_run(lmsm_batch *batch, int threads) {
+    if (threads <= 0) {
+        threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > batch->count) {
+        threads = batch->count;
+    }
+
+    // largest first, so the longest job is never the one left running alone at the end
+    lmsm_batch_job **by_size = malloc(sizeof(lmsm_batch_job *) * (batch->count + 1));
+    for (int i = 0; i < batch->count; ++i) {
+        by_size[i] = &batch->jobs[i];
+    }
+    qsort(by_size, batch->count, sizeof(lmsm_batch_job *), lmsm_batch_compare_sizes);
+    free(batch->schedule);
+    batch->schedule = malloc(sizeof(int) * (batch->count + 1));
+    for (int i = 0; i < batch->count; ++i) {
+        batch->schedule[i] = (int) (by_size[i] - batch->jobs);
+    }
+    free(by_size);
+    batch->next = 0;
+
+    pthread_t *workers = malloc(sizeof(pthread_t) * (threads + 1));
+    int started = 0;
+    for (int i = 0; i < threads; ++i) {
+        started += pthread_create(&workers[started], NULL, lmsm_batch_worker, batch) == 0;
+    }
+    if (started == 0) {
+        lmsm_batch_worker(batch);
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+}
+
+//======================================================
+// Main API
+//======================================================
+
+lmsm_batch *lmsm_batch_create(int code_size, int address_radix) {
+    lmsm_batch *batch = calloc(1, sizeof(lmsm_batch));
+    batch->code_size = code_size;
+    batch->address_radix = address_radix;
+    pthread_mutex_init(&batch->lock, NULL);
+    return batch;
+}
+
+void lmsm_batch_delete(lmsm_batch *batch) {
+    for (int i = 0; i < batch->count; ++i) {
+        free(batch->jobs[i].source);
+        free(batch->jobs[i].object);
+    }
+    free(batch->jobs);
+    free(batch->schedule);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch);
+}
+
+int lmsm_batch_print_summary(lmsm_batch *batch, FILE *out) {
+    int built = 0;
+    int unchanged = 0;
+    int failed = 0;
+    for (int i = 0; i < batch->count; ++i) {
+        lmsm_batch_job *job = &batch->jobs[i];
+        if (job->status == BATCH_FAILED) {
+            fprintf(out, "FAILED %s\n  %s\n", job->source, job->error);
+            failed++;
+        } else if (job->status == BATCH_BUILT) {
+            fprintf(out, "built  %s (%d slots, %d imports)\n", job->source, job->slots, job->imports);
+            built++;
+        } else if (job->status == BATCH_UNCHANGED) {
+            unchanged++;
+        }
+    }
+    fprintf(out, "%d built, %d unchanged, %d failed\n", built, unchanged, failed);
+    return failed;
+}
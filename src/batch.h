@@ -0,0 +1,60 @@
+#ifndef LMSM_BATCH_H
+#define LMSM_BATCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define BATCH_ERROR_SIZE 200
+
+//===================================================================
+//  Assembles a library of sources into the .lmo objects the linker
+//  caches them in, across a pool of threads
+//===================================================================
+
+typedef enum lmsm_batch_status {
+    BATCH_PENDING,
+    BATCH_BUILT,
+    BATCH_UNCHANGED,   // the object already holds the assembly of this exact source
+    BATCH_FAILED,
+} lmsm_batch_status;
+
+typedef struct lmsm_batch_job {
+    char *source;
+    char *object;
+    long size;                    // of the source, the biggest jobs are started first
+    lmsm_batch_status status;
+    int slots;
+    int imports;                  // labels left for the linker to resolve
+    char error[BATCH_ERROR_SIZE];
+} lmsm_batch_job;
+
+typedef struct lmsm_batch {
+    lmsm_batch_job *jobs;         // in the order they were added
+    int count;
+    int capacity;
+    int code_size;
+    int address_radix;
+    int *schedule;                // job indexes, largest source first
+    int next;                     // the next entry of the schedule to take
+    pthread_mutex_t lock;
+} lmsm_batch;
+
+//=====================================================
+// API
+//=====================================================
+
+lmsm_batch *lmsm_batch_create(int code_size, int address_radix);
+
+void lmsm_batch_delete(lmsm_batch *batch);
+
+// adds every .asm and .firth file in a directory, or every path listed in a manifest (one per line, # comments),
+// returns 0 if the path cannot be read
+int lmsm_batch_add(lmsm_batch *batch, char *path);
+
+// builds every job on the given number of threads (0 for one per processor)
+void lmsm_batch_run(lmsm_batch *batch, int threads);
+
+// prints every error and the totals, returns the number of failed jobs
+int lmsm_batch_print_summary(lmsm_batch *batch, FILE *out);
+
+#endif //LMSM_BATCH_H
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "checkpoint.h"
+#include "history.h"
+
+//======================================================
+// Saving
+//======================================================
+
+int lmsm_checkpoint_save(lmsm *our_little_machine, char *path) {
+    lmsm_checkpoint_header header = {0};
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.memory_size = our_little_machine->memory_size;
+    header.address_radix = our_little_machine->address_radix;
+    header.input_length = our_little_machine->input_length;
+    header.output_length = our_little_machine->output_length;
+    header.program_counter = our_little_machine->program_counter;
+    header.current_instruction = our_little_machine->current_instruction;
+    header.status = our_little_machine->status;
+    header.error_code = our_little_machine->error_code;
+    header.accumulator = our_little_machine->accumulator;
+    header.stack_pointer = our_little_machine->stack_pointer;
+    header.return_address_pointer = our_little_machine->return_address_pointer;
+    header.input_position = our_little_machine->input_position;
+
+    // write beside the old checkpoint and rename over it, so a crash never leaves a torn file
+    char *temporary = calloc(strlen(path) + strlen(".tmp") + 1, sizeof(char));
+    strcat(temporary, path);
+    strcat(temporary, ".tmp");
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        free(temporary);
+        return 0;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(our_little_machine->memory, sizeof(int), header.memory_size, file);
+    fwrite(our_little_machine->input_buffer, sizeof(int), header.input_length, file);
+    fwrite(our_little_machine->output_buffer, sizeof(char), header.output_length, file);
+    int saved = fclose(file) == 0 && rename(temporary, path) == 0;
+    free(temporary);
+    return saved;
+}
+
+//======================================================
+// Restoring
+//======================================================
+
+// whether the stacks and program counter lie in the memory, as the machine only bounds them as they move
+int lmsm_checkpoint_registers_fit(lmsm_checkpoint_header *header) {
+    int memory_size = (int) header->memory_size;
+    // the return address stack starts empty at the last code slot, as lmsm_configure gives code half the memory,
+    // and a halt on a bad address keeps the address in the program counter
+    int code_size = memory_size / 2;
+    return code_size - 1 <= header->return_address_pointer &&
+           header->return_address_pointer < header->stack_pointer &&
+           header->stack_pointer <= memory_size &&
+           (header->status == STATUS_HALTED ||
+            (0 <= header->program_counter && header->program_counter <= memory_size));
+}
+
+int lmsm_checkpoint_restore(lmsm *our_little_machine, char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    lmsm_checkpoint_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CHECKPOINT_MAGIC || header.version != CHECKPOINT_VERSION ||
+        header.memory_size > MAX_MEMORY_SIZE ||
+        header.input_length > INT_MAX || header.output_length >= OUTPUT_BUFFER_SIZE ||
+        header.input_position < 0 || header.input_position > (int) header.input_length ||
+        !lmsm_checkpoint_registers_fit(&header)) {
+        fclose(file);
+        return 0;
+    }
+
+    // read into a scratch machine so a truncated file leaves the real one untouched, with an input queue of its
+    // own that grows only as far as the file actually has values
+    lmsm *restored = malloc(sizeof(lmsm));
+    memcpy(restored, our_little_machine, sizeof(lmsm));
+    restored->input_buffer = NULL;
+    restored->input_length = 0;
+    restored->input_capacity = 0;
+    int *memory = malloc(sizeof(int) * header.memory_size);
+    int complete = fread(memory, sizeof(int), header.memory_size, file) == header.memory_size;
+    int value;
+    while (complete && restored->input_length < (int) header.input_length) {
+        complete = fread(&value, sizeof(int), 1, file) == 1 && lmsm_queue_input(restored, value);
+    }
+    complete = complete &&
+               fread(restored->output_buffer, sizeof(char), header.output_length, file) == header.output_length &&
+               lmsm_configure(our_little_machine, (int) header.memory_size, (int) header.address_radix);
+    fclose(file);
+    if (complete) {
+        free(our_little_machine->input_buffer);
+        memcpy(our_little_machine->memory, memory, sizeof(int) * header.memory_size);
+        restored->memory = our_little_machine->memory;
+        restored->memory_size = our_little_machine->memory_size;
+        restored->code_size = our_little_machine->code_size;
+        restored->address_radix = our_little_machine->address_radix;
+        restored->output_buffer[header.output_length] = '\0';
+        restored->output_length = (int) header.output_length;
+        restored->input_position = header.input_position;
+        restored->program_counter = header.program_counter;
+        restored->current_instruction = header.current_instruction;
+        restored->status = (machine_status) header.status;
+        restored->error_code = (error_code) header.error_code;
+        restored->accumulator = header.accumulator;
+        restored->stack_pointer = header.stack_pointer;
+        restored->return_address_pointer = header.return_address_pointer;
+        restored->watch_hit = -1;
+        restored->breakpoint_hit = -1;
+        memcpy(our_little_machine, restored, sizeof(lmsm));
+        if (our_little_machine->history) {
+            lmsm_history_clear(our_little_machine->history);
+        }
+    } else {
+        free(restored->input_buffer);
+    }
+    free(memory);
+    free(restored);
+    return complete;
+}
+
+//======================================================
+// Periodic Checkpoints
+//======================================================
+
+void lmsm_run_with_checkpoints(lmsm *our_little_machine, long every, char *path) {
+    long countdown = every;
+    our_little_machine->status = STATUS_RUNNING;
+    while (our_little_machine->status != STATUS_HALTED) {
+        lmsm_step(our_little_machine);
+        if (--countdown == 0) {
+            lmsm_checkpoint_save(our_little_machine, path);
+            countdown = every;
+        }
+    }
+    lmsm_checkpoint_save(our_little_machine, path);
+}
@@ -0,0 +1,51 @@
+#ifndef LMSM_CHECKPOINT_H
+#define LMSM_CHECKPOINT_H
+
+#include "lmsm.h"
+
+#define CHECKPOINT_MAGIC 0x4B434D4C   // "LMCK"
+#define CHECKPOINT_VERSION 2
+
+//===================================================================
+//  On disk layout, all fields are 4 bytes:
+//
+//    lmsm_checkpoint_header
+//    int memory[memory_size]
+//    int input[input_length]
+//    char output[output_length]
+//
+//  Debugging aids (trace, history, breakpoints) are not saved.
+//===================================================================
+
+typedef struct lmsm_checkpoint_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int memory_size;
+    unsigned int address_radix;
+    unsigned int input_length;
+    unsigned int output_length;
+    int program_counter;
+    int current_instruction;
+    int status;
+    int error_code;
+    int accumulator;
+    int stack_pointer;
+    int return_address_pointer;
+    int input_position;
+} lmsm_checkpoint_header;
+
+//=====================================================
+// API
+//=====================================================
+
+// atomically replaces the file at path with the state of the machine, returns 1 on success
+int lmsm_checkpoint_save(lmsm *our_little_machine, char *path);
+
+// restores a machine saved by lmsm_checkpoint_save, including its memory layout,
+// returns 0 (leaving the machine alone) if invalid
+int lmsm_checkpoint_restore(lmsm *our_little_machine, char *path);
+
+// runs the machine to completion, saving a checkpoint every `every` steps and once more at the end
+void lmsm_run_with_checkpoints(lmsm *our_little_machine, long every, char *path);
+
+#endif //LMSM_CHECKPOINT_H
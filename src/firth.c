@@ -3,46 +3,55 @@
 #include <string.h>
 #include "firth.h"
 #include "assembler.h"
+#include "lexer.h"
+#include "lmsm.h"
 
 //======================================================
 // Tokenization
 //======================================================
 
-firth_tokens *firth_tokenize(char *firth_src) {
-    char *src = calloc(strlen(firth_src) + 1, sizeof(char));
-    strcat(src, firth_src);
-    char *str = strtok(src, " \n");
-    firth_tokens *tokens = calloc(1, sizeof(firth_tokens));
-    tokens->original_src = src;
-    while (str != NULL) {
-        firth_token *token = calloc(1, sizeof(firth_token));
-        token->value = str;
-        if (tokens->start == NULL) {
-            tokens->start = token;
-        }
-        if (tokens->current != NULL) {
-            tokens->current->next = token;
-        }
-        tokens->current = token;
-        str = strtok(NULL, " \n");
-    }
-    tokens->current = tokens->start;
+// the tokens go in one array in the result's arena
+firth_tokens *firth_tokenize(char *firth_src, lmsm_arena *arena) {
+    firth_tokens *tokens = lmsm_arena_alloc(arena, sizeof(firth_tokens));
+    int count;
+    lmsm_token *lexed = lmsm_lex(firth_src, strlen(firth_src), 1, &count);
+    tokens->start = lmsm_arena_alloc(arena, sizeof(firth_token) * (count + 1));
+    tokens->count = count;
+    for (int i = 0; i < count; ++i) {
+        firth_token *token = &tokens->start[i];
+        token->start = firth_src + lexed[i].start;
+        token->length = lexed[i].length;
+        token->line = lexed[i].line;
+        token->column = lexed[i].column;
+        token->number = lexed[i].number;
+    }
+    free(lexed);
     return tokens;
 }
 
+int firth_token_equals(const firth_token *token, const char *str) {
+    return strncmp(token->start, str, token->length) == 0 && str[token->length] == '\0';
+}
+
+firth_token *firth_current_token(firth_tokens *tokens) {
+    return tokens->current < tokens->count ? &tokens->start[tokens->current] : NULL;
+}
+
 int firth_match_token(char *str, firth_tokens *tokens) {
-    return tokens->current && strcmp(str, tokens->current->value) == 0;
+    firth_token *current = firth_current_token(tokens);
+    return current && firth_token_equals(current, str);
 }
 
 int firth_has_more_tokens(firth_tokens *tokens) {
-    return tokens->current != NULL;
+    return tokens->current < tokens->count;
 }
 
 int firth_token_ends_with(firth_token * token, char *suffix)
 {
-    if(strlen(token->value) >= strlen(suffix))
+    int length = (int) strlen(suffix);
+    if(token->length >= length)
     {
-        if(!strcmp(token->value + strlen(token->value) - strlen(suffix), suffix))
+        if(!strncmp(token->start + token->length - length, suffix, length))
         {
             return 1;
         }
@@ -51,36 +60,39 @@ int firth_token_ends_with(firth_token * token, char *suffix)
 }
 
 firth_token *firth_take_token(firth_tokens *tokens) {
-    struct firth_token *current = tokens->current;
+    firth_token *current = firth_current_token(tokens);
     if (current != NULL) {
-        tokens->current = current->next;
+        tokens->current++;
     }
     return current;
 }
 
 void firth_report_error(char *msg, firth_tokens *tokens, firth_compilation_result *result) {
     result->error = msg;
-    tokens->current = NULL;
+    tokens->current = tokens->count;
 }
 
 //======================================================
 // Parsing
 //======================================================
 
-// declarations
-firth_parse_element *firth_parse_elt(firth_tokens *tokens, firth_compilation_result *result);
-
-// implementations
+// a zero? or def that has not reached its end yet
+typedef struct firth_open_element {
+    firth_parse_element *elt;
+    firth_parse_elements *children;  // the list being parsed into, the right one of a zero? after its else
+} firth_open_element;
 
-void firth_delete_exprs(firth_parse_elements *elts);
-
-firth_parse_element *firth_make_elt(firth_token *token, firth_parse_element_type type){
-    firth_parse_element *elt = calloc(1, sizeof(firth_parse_element));
+firth_parse_element *firth_make_elt(firth_compilation_result *result, firth_token *token, firth_parse_element_type type){
+    firth_parse_element *elt = lmsm_arena_alloc(&result->arena, sizeof(firth_parse_element));
     elt->token = token;
     elt->type = type;
     return elt;
 }
 
+firth_parse_elements *firth_make_elements(firth_compilation_result *result) {
+    return lmsm_arena_alloc(&result->arena, sizeof(firth_parse_elements));
+}
+
 void firth_add_element(firth_parse_elements *elements, firth_parse_element *elt) {
     if (elements->first == NULL) {
         elements->first = elt;
@@ -92,42 +104,33 @@ void firth_add_element(firth_parse_elements *elements, firth_parse_element *elt)
 }
 
 firth_parse_element *firth_parse_num(firth_tokens *tokens, firth_compilation_result *result) {
-    if (asm_is_num(tokens->current->value)) {
-        return firth_make_elt(firth_take_token(tokens), NUMBER);
+    if (firth_current_token(tokens)->number) {
+        return firth_make_elt(result, firth_take_token(tokens), NUMBER);
     }
     return NULL;
 }
 
+// the start of a def, its body is parsed into its left children until its end
 firth_parse_element *firth_parse_def(firth_tokens *tokens, firth_compilation_result *result) {
     if (firth_match_token("def", tokens)) {
-        firth_parse_element *fun = firth_make_elt(firth_take_token(tokens), DEF);
+        firth_parse_element *fun = firth_make_elt(result, firth_take_token(tokens), DEF);
 
         firth_token *function_name = firth_take_token(tokens);
-        if (!firth_token_ends_with(function_name, "()")) {
+        if (function_name == NULL || !firth_token_ends_with(function_name, "()")) {
             firth_report_error("function must end with parens", tokens, result);
             return fun;
         }
         fun->name = function_name;
 
-        fun->left_children = calloc(1, sizeof(firth_parse_elements));
-
-        while (firth_has_more_tokens(tokens) &&
-               !firth_match_token("end", tokens)) {
-            firth_add_element(fun->left_children, firth_parse_elt(tokens, result));
-        }
-        if (firth_match_token("end", tokens)) {
-            firth_take_token(tokens);
-        } else {
-            firth_report_error("Expected end for fun? statement", tokens, result);
-        }
+        fun->left_children = firth_make_elements(result);
         return fun;
     }
     return NULL;
 }
 
 firth_parse_element *firth_parse_call(firth_tokens *tokens, firth_compilation_result *result) {
-    if (tokens->current && firth_token_ends_with(tokens->current, "()")) {
-        firth_parse_element *call = firth_make_elt(firth_take_token(tokens), CALL);
+    if (firth_token_ends_with(firth_current_token(tokens), "()")) {
+        firth_parse_element *call = firth_make_elt(result, firth_take_token(tokens), CALL);
         return call;
     }
     return NULL;
@@ -147,35 +150,18 @@ firth_parse_element *firth_parse_op(firth_tokens *tokens, firth_compilation_resu
         firth_match_token("swap", tokens) ||
         firth_match_token("return", tokens) ||
         firth_match_token(".", tokens)) {
-        return firth_make_elt(firth_take_token(tokens), OP);
+        return firth_make_elt(result, firth_take_token(tokens), OP);
     }
     return NULL;
 }
 
+// the start of a zero?, its branches are parsed into its children until its else and end
 firth_parse_element *firth_parse_zero(firth_tokens *tokens, firth_compilation_result *result) {
     if (firth_match_token("zero?", tokens)) {
-        firth_parse_element *zero = firth_make_elt(firth_take_token(tokens), ZERO_TEST);
-
-        zero->left_children = calloc(1, sizeof(firth_parse_elements));
-        zero->right_children = calloc(1, sizeof(firth_parse_elements));
+        firth_parse_element *zero = firth_make_elt(result, firth_take_token(tokens), ZERO_TEST);
 
-        while (firth_has_more_tokens(tokens) &&
-               !firth_match_token("else", tokens) &&
-               !firth_match_token("end", tokens)) {
-            firth_add_element(zero->left_children, firth_parse_elt(tokens, result));
-        }
-        if (firth_match_token("else", tokens)) {
-            firth_take_token(tokens);
-            while (firth_has_more_tokens(tokens) &&
-                   !firth_match_token("end", tokens)) {
-                firth_add_element(zero->right_children, firth_parse_elt(tokens, result));
-            }
-        }
-        if (firth_match_token("end", tokens)) {
-            firth_take_token(tokens);
-        } else {
-            firth_report_error("Expected end for zero? statement", tokens, result);
-        }
+        zero->left_children = firth_make_elements(result);
+        zero->right_children = firth_make_elements(result);
         return zero;
     }
     return NULL;
@@ -208,51 +194,729 @@ firth_parse_element *firth_parse_elt(firth_tokens *tokens, firth_compilation_res
         return call;
     }
 
-    firth_parse_element *error_elt = firth_make_elt(firth_take_token(tokens), ERROR);
+    firth_parse_element *error_elt = firth_make_elt(result, firth_take_token(tokens), ERROR);
     firth_report_error("Unknown token", tokens, result);
     return error_elt;
 }
 
+// parses the program into the root elements, keeping the zero? and def elements still open on a stack rather than
+// recursing into them
+void firth_parse(firth_tokens *tokens, firth_compilation_result *result) {
+    // each generates at least one instruction, so nesting deeper than the code space is never a program that fits,
+    // and the passes after this one recurse a level at a time
+    firth_open_element *open = malloc(sizeof(firth_open_element) * (result->code_size + 1));
+    int depth = 0;
+    firth_parse_elements *children = result->root_elements;
+    while (firth_has_more_tokens(tokens)) {
+        firth_open_element *innermost = depth > 0 ? &open[depth - 1] : NULL;
+        if (innermost && firth_match_token("end", tokens)) {
+            firth_take_token(tokens);
+            depth--;
+            children = depth > 0 ? open[depth - 1].children : result->root_elements;
+        } else if (innermost && innermost->elt->type == ZERO_TEST && children == innermost->elt->left_children &&
+                   firth_match_token("else", tokens)) {
+            firth_take_token(tokens);
+            children = innermost->children = innermost->elt->right_children;
+        } else {
+            firth_parse_element *elt = firth_parse_elt(tokens, result);
+            firth_add_element(children, elt);
+            if (result->error == NULL && (elt->type == ZERO_TEST || elt->type == DEF)) {
+                if (depth == result->code_size) {
+                    firth_report_error("zero? and def nested too deeply", tokens, result);
+                } else {
+                    open[depth].elt = elt;
+                    open[depth].children = elt->left_children;
+                    children = elt->left_children;
+                    depth++;
+                }
+            }
+        }
+    }
+    if (depth > 0 && result->error == NULL) {
+        firth_report_error(open[0].elt->type == ZERO_TEST ? "Expected end for zero? statement" :
+                           "Expected end for fun? statement", tokens, result);
+    }
+    free(open);
+}
+
+//======================================================
+// Constant Folding
+//======================================================
+
+int firth_is_op(const firth_parse_element *elt, const char *op) {
+    return elt->type == OP && firth_token_equals(elt->token, op);
+}
+
+// the value a NUMBER pushes, returns 0 unless it is one an LDI can load
+int firth_constant(const firth_parse_element *elt, int address_radix, int *value) {
+    if (elt->type != NUMBER) {
+        return 0;
+    }
+    // the digits of the token end at the separator after them
+    long parsed = elt->folded ? elt->value : strtol(elt->token->start, NULL, 10);
+    *value = (int) parsed;
+    return 0 <= parsed && parsed < address_radix;
+}
+
+void firth_set_constant(firth_parse_element *elt, int value) {
+    elt->type = NUMBER;
+    elt->value = value;
+    elt->folded = 1;
+}
+
+// what the machine pushes for second <op> first, capped as the stack instructions cap it, 0 if it cannot be folded
+int firth_fold(const firth_parse_element *op, int second, int first, int limit, int *value) {
+    if (firth_is_op(op, "+")) {
+        *value = second + first >= limit ? limit : second + first;
+    } else if (firth_is_op(op, "-")) {
+        *value = second - first <= -limit ? -limit : second - first;
+    } else if (firth_is_op(op, "*")) {
+        *value = second * first >= limit ? limit : second * first;
+    } else if (firth_is_op(op, "/") && first != 0) {
+        *value = second / first >= limit ? limit : second / first;
+    } else if (firth_is_op(op, "max")) {
+        *value = first > second ? first : second;
+    } else if (firth_is_op(op, "min")) {
+        *value = first > second ? second : first;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// how many values are known to be on the stack after an element, given how many were before it. An instruction
+// short of values halts the machine, so whatever it needed was there if anything runs after it
+int firth_known_depth(const firth_parse_element *elt, int depth) {
+    int at_least_one = depth > 1 ? depth : 1;
+    int at_least_two = depth > 2 ? depth : 2;
+    if (elt->type == NUMBER || firth_is_op(elt, "get")) {
+        return depth + 1;
+    } else if (firth_is_op(elt, "dup")) {
+        return at_least_one + 1;
+    } else if (firth_is_op(elt, "pop")) {
+        return at_least_one - 1;
+    } else if (firth_is_op(elt, ".")) {
+        return at_least_one;
+    } else if (firth_is_op(elt, "swap")) {
+        return at_least_two;
+    } else if (elt->type == OP && !firth_is_op(elt, "return")) {
+        return at_least_two - 1;
+    }
+    // calls, tests and returns leave the stack to code elsewhere
+    return 0;
+}
+
+// rewrites the end of a straight run of elements for as long as it matches, returns the new length of the run,
+// depths[i] being the values known to be on the stack before run[i]
+int firth_reduce(firth_parse_element **run, int *depths, int count, int address_radix) {
+    int limit = address_radix * 10 - 1;
+    while (count >= 2) {
+        firth_parse_element *last = run[count - 1];
+        firth_parse_element *before = run[count - 2];
+        firth_parse_element *third = count >= 3 ? run[count - 3] : NULL;
+        int dup = firth_is_op(before, "dup");
+        int first;
+        int second;
+        int folded;
+        if (third && firth_constant(third, address_radix, &second) &&
+            (dup || firth_constant(before, address_radix, &first)) &&
+            firth_fold(last, second, dup ? second : first, limit, &folded) && 0 <= folded && folded < address_radix) {
+            // n m <op> or n dup <op> is a single constant
+            // what is dropped stays in the arena until the result goes
+            firth_set_constant(third, folded);
+            count -= 2;
+        } else if (third && firth_is_op(last, "swap") && firth_constant(third, address_radix, &second) &&
+                   firth_constant(before, address_radix, &first)) {
+            firth_set_constant(third, first);
+            firth_set_constant(before, second);
+            count -= 1;
+        } else if (firth_is_op(last, "pop") &&
+                   (firth_constant(before, address_radix, &first) || (dup && depths[count - 2] >= 1))) {
+            // pushed only to be popped again
+            count -= 2;
+        } else if (firth_is_op(last, "swap") && firth_is_op(before, "swap") && depths[count - 2] >= 2) {
+            count -= 2;
+        } else {
+            break;
+        }
+    }
+    return count;
+}
+
+void firth_fold_elements(firth_parse_elements *elements, int address_radix) {
+    int count = 0;
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        if (elt->left_children) {
+            firth_fold_elements(elt->left_children, address_radix);
+        }
+        if (elt->right_children) {
+            firth_fold_elements(elt->right_children, address_radix);
+        }
+        count++;
+    }
+
+    firth_parse_element **run = malloc(sizeof(firth_parse_element *) * (count + 1));
+    int *depths = malloc(sizeof(int) * (count + 1));
+    int kept = 0;
+    depths[0] = 0;
+    firth_parse_element *elt = elements->first;
+    while (elt != NULL) {
+        firth_parse_element *next = elt->next_sibling;
+        elt->next_sibling = NULL;
+        run[kept] = elt;
+        depths[kept + 1] = firth_known_depth(elt, depths[kept]);
+        kept = firth_reduce(run, depths, kept + 1, address_radix);
+        elt = next;
+    }
+
+    elements->first = NULL;
+    elements->last = NULL;
+    for (int i = 0; i < kept; ++i) {
+        firth_add_element(elements, run[i]);
+    }
+    free(run);
+    free(depths);
+}
+
+//======================================================
+// Tail Calls
+//======================================================
+
+// marks the calls nothing would run after but a RET, which can jump to the function and leave the RET to it
+void firth_mark_tail_calls(firth_parse_elements *elements, int in_tail) {
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        firth_parse_element *next = elt->next_sibling;
+        int returns_next = next == NULL ? in_tail : firth_is_op(next, "return");
+        if (elt->type == CALL) {
+            elt->tail = returns_next;
+        } else if (elt->type == ZERO_TEST) {
+            // both branches come out at the end of the test
+            firth_mark_tail_calls(elt->left_children, returns_next);
+            firth_mark_tail_calls(elt->right_children, returns_next);
+        } else if (elt->type == DEF) {
+            firth_mark_tail_calls(elt->left_children, 1);
+        }
+    }
+}
+
+int firth_falls_through(const firth_parse_elements *elements);
+
+// whether running the element can carry on to the one after it, rather than leaving by a tail call or a return
+int firth_elt_falls_through(const firth_parse_element *elt) {
+    if (elt->type == ZERO_TEST) {
+        // an empty zero branch goes straight to the end
+        return !elt->left_children->first || firth_falls_through(elt->left_children) ||
+               firth_falls_through(elt->right_children);
+    }
+    return !(elt->type == CALL && elt->tail) && !firth_is_op(elt, "return");
+}
+
+// whether running the elements can reach their end, the code after a return is still generated, labels and all,
+// so only the last one decides
+int firth_falls_through(const firth_parse_elements *elements) {
+    return elements->last == NULL || firth_elt_falls_through(elements->last);
+}
+
+//======================================================
+// Inlining
+//======================================================
+
+typedef struct firth_inliner {
+    firth_parse_element **definitions;
+    int count;
+    int *inlinable;     // by definition, whether a copy of the body behaves as the call does
+    int *slots;         // by definition, of the body
+    int budget;         // slots the program can still grow by
+    lmsm_arena *arena;  // the copies go in
+} firth_inliner;
+
+int firth_slots(const firth_parse_elements *elements);
+
+// the slots an element is generated in, before tail calls are marked
+int firth_elt_slots(const firth_parse_element *elt) {
+    if (elt->type == NUMBER || firth_is_op(elt, "get")) {
+        return 2;
+    } else if (firth_is_op(elt, ".")) {
+        return 3;
+    } else if (elt->type == OP) {
+        return 1;
+    } else if (elt->type == CALL) {
+        return 3;
+    } else if (elt->type == ZERO_TEST) {
+        return 3 + firth_slots(elt->left_children) + firth_slots(elt->right_children);
+    } else if (elt->type == DEF) {
+        return 1 + firth_slots(elt->left_children);
+    }
+    return 0;
+}
+
+int firth_slots(const firth_parse_elements *elements) {
+    int slots = 0;
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        slots += firth_elt_slots(elt);
+    }
+    return slots;
+}
+
+int firth_defines(const firth_parse_element *definition, const firth_token *call) {
+    firth_token *name = definition->name;
+    return name->length == call->length && strncmp(name->start, call->start, call->length) == 0;
+}
+
+// the index of the definition a call is to, -1 if it is not defined at the top level (e.g. an import)
+int firth_find_definition(const firth_inliner *inliner, const firth_token *call) {
+    for (int i = 0; i < inliner->count; ++i) {
+        if (firth_defines(inliner->definitions[i], call)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// whether two top level definitions share a name, which the assembler would reject as a duplicate label
+int firth_has_duplicate_definition(const firth_parse_elements *elements) {
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        for (firth_parse_element *other = elt->next_sibling; elt->type == DEF && other != NULL;
+             other = other->next_sibling) {
+            if (other->type == DEF && firth_defines(elt, other->name)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// whether the elements can call the target definition, directly or through the definitions they call
+int firth_reaches(const firth_inliner *inliner, const firth_parse_elements *elements, int target, char *visited) {
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        if ((elt->left_children && firth_reaches(inliner, elt->left_children, target, visited)) ||
+            (elt->right_children && firth_reaches(inliner, elt->right_children, target, visited))) {
+            return 1;
+        }
+        int index = elt->type == CALL ? firth_find_definition(inliner, elt->token) : -1;
+        if (index == target) {
+            return 1;
+        }
+        if (index >= 0 && !visited[index]) {
+            visited[index] = 1;
+            if (firth_reaches(inliner, inliner->definitions[index]->left_children, target, visited)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// a return would leave the caller rather than the copy, so a body with one is only ever called
+int firth_can_inline(const firth_parse_elements *elements) {
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        if (firth_is_op(elt, "return") || elt->type == DEF || elt->type == ERROR ||
+            (elt->left_children && !firth_can_inline(elt->left_children)) ||
+            (elt->right_children && !firth_can_inline(elt->right_children))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+firth_parse_elements *firth_copy_elements(lmsm_arena *arena, const firth_parse_elements *elements);
+
+firth_parse_element *firth_copy_elt(lmsm_arena *arena, const firth_parse_element *elt) {
+    firth_parse_element *copy = lmsm_arena_alloc(arena, sizeof(firth_parse_element));
+    *copy = *elt;
+    copy->next_sibling = NULL;
+    copy->left_children = elt->left_children ? firth_copy_elements(arena, elt->left_children) : NULL;
+    copy->right_children = elt->right_children ? firth_copy_elements(arena, elt->right_children) : NULL;
+    return copy;
+}
+
+firth_parse_elements *firth_copy_elements(lmsm_arena *arena, const firth_parse_elements *elements) {
+    firth_parse_elements *copy = lmsm_arena_alloc(arena, sizeof(firth_parse_elements));
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        firth_add_element(copy, firth_copy_elt(arena, elt));
+    }
+    return copy;
+}
+
+void firth_measure_definitions(firth_inliner *inliner) {
+    for (int i = 0; i < inliner->count; ++i) {
+        inliner->slots[i] = firth_slots(inliner->definitions[i]->left_children);
+    }
+}
+
+// replaces each call worth it with a copy of the body it calls, returns the number replaced
+int firth_inline_elements(firth_inliner *inliner, firth_parse_elements *elements) {
+    int inlined = 0;
+    firth_parse_element **link = &elements->first;
+    firth_parse_element *last = NULL;
+    while (*link != NULL) {
+        firth_parse_element *elt = *link;
+        int index = elt->type == CALL ? firth_find_definition(inliner, elt->token) : -1;
+        int growth = index >= 0 ? inliner->slots[index] - firth_elt_slots(elt) : 0;
+        if (index >= 0 && inliner->inlinable[index] && inliner->slots[index] <= FIRTH_INLINE_SLOTS &&
+            growth <= inliner->budget) {
+            firth_parse_elements *body = firth_copy_elements(inliner->arena, inliner->definitions[index]->left_children);
+            if (body->first) {
+                body->last->next_sibling = elt->next_sibling;
+                *link = body->first;
+            } else {
+                *link = elt->next_sibling;
+            }
+            inliner->budget -= growth;
+            inlined++;
+            // the copy is looked at next, for the calls in it
+            continue;
+        }
+        if (elt->left_children) {
+            inlined += firth_inline_elements(inliner, elt->left_children);
+        }
+        if (elt->right_children) {
+            inlined += firth_inline_elements(inliner, elt->right_children);
+        }
+        last = elt;
+        link = &elt->next_sibling;
+    }
+    elements->last = last;
+    return inlined;
+}
+
+// copies small functions that never call themselves over the calls to them, growing the program by at most half
+// of the code space it leaves free, returns the number of calls replaced
+int firth_inline(firth_compilation_result *result, firth_parse_elements *top_level, firth_parse_elements *definitions) {
+    firth_inliner inliner = {0};
+    inliner.arena = &result->arena;
+    for (firth_parse_element *elt = definitions->first; elt != NULL; elt = elt->next_sibling) {
+        inliner.count++;
+    }
+    inliner.definitions = malloc(sizeof(firth_parse_element *) * (inliner.count + 1));
+    inliner.inlinable = calloc(inliner.count + 1, sizeof(int));
+    inliner.slots = calloc(inliner.count + 1, sizeof(int));
+    char *visited = malloc(inliner.count + 1);
+    int index = 0;
+    for (firth_parse_element *elt = definitions->first; elt != NULL; elt = elt->next_sibling) {
+        inliner.definitions[index++] = elt;
+    }
+    for (int i = 0; i < inliner.count; ++i) {
+        memset(visited, 0, inliner.count);
+        inliner.inlinable[i] = firth_can_inline(inliner.definitions[i]->left_children) &&
+                               !firth_reaches(&inliner, inliner.definitions[i]->left_children, i, visited);
+    }
+    firth_measure_definitions(&inliner);
+    int free_slots = result->code_size - (firth_slots(top_level) + 1 + firth_slots(definitions));
+    inliner.budget = free_slots > 0 ? free_slots / 2 : 0;
+
+    // the functions first, so a copy of one already has what it calls in it
+    int inlined = firth_inline_elements(&inliner, definitions);
+    firth_measure_definitions(&inliner);
+    inlined += firth_inline_elements(&inliner, top_level);
+
+    free(inliner.definitions);
+    free(inliner.inlinable);
+    free(inliner.slots);
+    free(visited);
+    return inlined;
+}
+
+//======================================================
+// Dead Functions
+//======================================================
+
+// marks every definition of each function the elements call, and what those call in turn
+void firth_mark_live(firth_parse_element **definitions, int count, const firth_parse_elements *elements, char *live) {
+    for (firth_parse_element *elt = elements->first; elt != NULL; elt = elt->next_sibling) {
+        if (elt->left_children) {
+            firth_mark_live(definitions, count, elt->left_children, live);
+        }
+        if (elt->right_children) {
+            firth_mark_live(definitions, count, elt->right_children, live);
+        }
+        for (int i = 0; elt->type == CALL && i < count; ++i) {
+            if (!live[i] && firth_defines(definitions[i], elt->token)) {
+                live[i] = 1;
+                firth_mark_live(definitions, count, definitions[i]->left_children, live);
+            }
+        }
+    }
+}
+
+// drops the definitions nothing run from the top level can call, counting them and their slots in the result
+void firth_remove_dead_functions(firth_compilation_result *result, firth_parse_elements *top_level,
+                                 firth_parse_elements *definitions) {
+    int count = 0;
+    for (firth_parse_element *elt = definitions->first; elt != NULL; elt = elt->next_sibling) {
+        count++;
+    }
+    firth_parse_element **all = malloc(sizeof(firth_parse_element *) * (count + 1));
+    char *live = calloc(count + 1, 1);
+    int index = 0;
+    for (firth_parse_element *elt = definitions->first; elt != NULL; elt = elt->next_sibling) {
+        all[index++] = elt;
+    }
+    firth_mark_live(all, count, top_level, live);
+
+    definitions->first = NULL;
+    definitions->last = NULL;
+    for (int i = 0; i < count; ++i) {
+        all[i]->next_sibling = NULL;
+        if (live[i]) {
+            firth_add_element(definitions, all[i]);
+        } else {
+            result->removed_functions++;
+            result->removed_slots += firth_elt_slots(all[i]);
+        }
+    }
+    free(all);
+    free(live);
+}
+
+//======================================================
+// Optimisation
+//======================================================
+
+// folds constant arithmetic and drops stack shuffles that cancel out, exactly as the machine would run them, inlines
+// small functions (folding again what that brings together), drops the functions never called and marks the tail
+// calls
+void firth_optimize(firth_compilation_result *result) {
+    // before inlining or dropping either copy can hide it
+    if (firth_has_duplicate_definition(result->root_elements)) {
+        result->error = ASM_ERROR_DUPLICATE_LABEL;
+        return;
+    }
+    // the top level runs straight past the defs, which are generated after it, so they are moved out of its way
+    firth_parse_elements top_level = {0};
+    firth_parse_elements definitions = {0};
+    firth_parse_element *elt = result->root_elements->first;
+    while (elt != NULL) {
+        firth_parse_element *next = elt->next_sibling;
+        elt->next_sibling = NULL;
+        firth_add_element(elt->type == DEF ? &definitions : &top_level, elt);
+        elt = next;
+    }
+    firth_fold_elements(&top_level, result->address_radix);
+    firth_fold_elements(&definitions, result->address_radix);
+    if (firth_inline(result, &top_level, &definitions)) {
+        firth_fold_elements(&top_level, result->address_radix);
+        firth_fold_elements(&definitions, result->address_radix);
+    }
+    if (!result->keep_functions) {
+        firth_remove_dead_functions(result, &top_level, &definitions);
+    }
+    if (top_level.first == NULL) {
+        top_level = definitions;
+    } else if (definitions.first != NULL) {
+        top_level.last->next_sibling = definitions.first;
+        top_level.last = definitions.last;
+    }
+    *result->root_elements = top_level;
+    firth_mark_tail_calls(result->root_elements, 0);
+}
+
 //======================================================
 // Code Generation
 //======================================================
+
+// appends to the assembly at its tracked length, growing it as needed
+void firth_emit_slice(firth_compilation_result *result, const char *text, size_t length) {
+    if (result->assembly_length + length + 1 > result->assembly_capacity) {
+        while (result->assembly_length + length + 1 > result->assembly_capacity) {
+            result->assembly_capacity = result->assembly_capacity ? result->assembly_capacity * 2 : 1024;
+        }
+        result->lmsm_assembly = realloc(result->lmsm_assembly, result->assembly_capacity);
+    }
+    memcpy(result->lmsm_assembly + result->assembly_length, text, length);
+    result->assembly_length += length;
+    result->lmsm_assembly[result->assembly_length] = '\0';
+}
+
+void firth_emit(firth_compilation_result *result, const char *text) {
+    firth_emit_slice(result, text, strlen(text));
+}
+
+// emits one instruction (one line of assembly), the argument is a label or a number for those that take one
+void firth_emit_instruction(firth_compilation_result *result, const char *mnemonic, const char *argument, size_t length) {
+    if (result->emit_text) {
+        firth_emit(result, mnemonic);
+        if (argument) {
+            firth_emit(result, " ");
+            firth_emit_slice(result, argument, length);
+        }
+        firth_emit(result, "\n");
+    }
+    asm_compilation_result *assembly = result->assembly;
+    if (assembly && assembly->error == NULL) {
+        // the line and column the mnemonic has in the text, so debug info reads the same either way
+        int column = result->pending_label ? (int) strlen(result->pending_label) + 2 : 1;
+        asm_instruction *instruction = asm_add_instruction(assembly, result->last_instruction, mnemonic,
+                                                           result->pending_label, argument, (int) length,
+                                                           result->assembly_line, column);
+        if (instruction) {
+            result->last_instruction = instruction;
+        }
+    }
+    result->pending_label = NULL;
+    result->label_pending = 0;
+    result->assembly_line++;
+}
+
+// what the accumulator holds is unknown from here, e.g. at a label or after a call
+void firth_forget_accumulator(firth_compilation_result *result) {
+    result->accumulator_is_top = 0;
+    result->accumulator_known = 0;
+}
+
+// labels the next instruction
+void firth_emit_label(firth_compilation_result *result, const char *label, size_t length) {
+    if (result->label_pending) {
+        // an instruction has only one label, so the one waiting gets a branch to this one
+        firth_emit_instruction(result, "BRA", label, length);
+    }
+    if (result->emit_text) {
+        firth_emit_slice(result, label, length);
+        firth_emit(result, " ");
+    }
+    if (result->assembly) {
+        result->pending_label = lmsm_arena_strndup(&result->assembly->arena, label, length);
+    }
+    result->label_pending = 1;
+    // other paths come in here
+    firth_forget_accumulator(result);
+}
+
 int firth_elt_token_equals(const firth_parse_element * elt, const char *s2) {
-    return strcmp(elt->token->value, s2) == 0;
+    return firth_token_equals(elt->token, s2);
+}
+
+void firth_mark_source(firth_parse_element *elt, firth_compilation_result *result) {
+    firth_source_mark *mark = NULL;
+    if (result->source_mark_count > 0 &&
+        result->source_marks[result->source_mark_count - 1].assembly_line == result->assembly_line) {
+        // nothing was generated for the previous element on this line, so the newer one wins
+        mark = &result->source_marks[result->source_mark_count - 1];
+    } else {
+        if (result->source_mark_count == result->source_mark_capacity) {
+            result->source_mark_capacity = result->source_mark_capacity ? result->source_mark_capacity * 2 : 64;
+            result->source_marks = realloc(result->source_marks,
+                                           result->source_mark_capacity * sizeof(firth_source_mark));
+        }
+        mark = &result->source_marks[result->source_mark_count++];
+    }
+    mark->assembly_line = result->assembly_line;
+    mark->line = elt->token->line;
+    mark->column = elt->token->column;
+}
+
+// the label of a DAT cell holding the value, for ADD and SUB to take it from
+void firth_constant_label(firth_compilation_result *result, int value, char *label) {
+    int found = 0;
+    for (int i = 0; i < result->constant_count && !found; ++i) {
+        found = result->constants[i] == value;
+    }
+    if (!found) {
+        if (result->constant_count == result->constant_capacity) {
+            result->constant_capacity = result->constant_capacity ? result->constant_capacity * 2 : 8;
+            result->constants = realloc(result->constants, result->constant_capacity * sizeof(int));
+        }
+        result->constants[result->constant_count++] = value;
+    }
+    sprintf(label, "constant_%d", value);
 }
 
-void firth_code_gen_elt(firth_parse_element * elt, firth_compilation_result *result) {
+// whether the value left by a run of <constant> + and <constant> - starting at elt is printed next
+int firth_printed_after_sums(firth_parse_element *elt, int address_radix) {
+    int value;
+    while (elt != NULL && elt->next_sibling != NULL && firth_constant(elt, address_radix, &value) &&
+           (firth_is_op(elt->next_sibling, "+") || firth_is_op(elt->next_sibling, "-"))) {
+        elt = elt->next_sibling->next_sibling;
+    }
+    return elt != NULL && firth_is_op(elt, ".");
+}
+
+// generates an element, returns the next one to generate (which is past any element it generated along with it)
+firth_parse_element *firth_code_gen_elt(firth_parse_element * elt, firth_compilation_result *result) {
+    firth_mark_source(elt, result);
+    firth_parse_element *next = elt->next_sibling;
+    int value;
+    int constant = elt->type == NUMBER && firth_constant(elt, result->address_radix, &value);
     if (elt->type == OP) {
         if (firth_elt_token_equals(elt, ".")) {
-            strcat(result->lmsm_assembly, "SDUP\nSPOP\nOUT\n");
+            // the stack instructions leave the accumulator alone, so it can still hold what is on top. SPOP caps
+            // what it loads while the stack may hold a value past the cap, so a top printed this way is not one
+            if (!result->accumulator_is_top) {
+                firth_emit_instruction(result, "SDUP", NULL, 0);
+                firth_emit_instruction(result, "SPOP", NULL, 0);
+                result->accumulator_known = 0;
+            }
+            firth_emit_instruction(result, "OUT", NULL, 0);
         } else if (firth_elt_token_equals(elt, "+")) {
-            strcat(result->lmsm_assembly, "SADD\n");
+            firth_emit_instruction(result, "SADD", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "-")) {
-            strcat(result->lmsm_assembly, "SSUB\n");
+            firth_emit_instruction(result, "SSUB", NULL, 0);
+            result->accumulator_is_top = 0;
             // TODO - add assembly generation for *, /, max and min
         } else if (firth_elt_token_equals(elt, "min")) {
-            strcat(result->lmsm_assembly, "SMIN\n");
+            firth_emit_instruction(result, "SMIN", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "max")) {
-            strcat(result->lmsm_assembly, "SMAX\n");
+            firth_emit_instruction(result, "SMAX", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "*")) {
-            strcat(result->lmsm_assembly, "SMUL\n");
+            firth_emit_instruction(result, "SMUL", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "/")) {
-            strcat(result->lmsm_assembly, "SDIV\n");
+            firth_emit_instruction(result, "SDIV", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "get")) {
-            strcat(result->lmsm_assembly, "INP\nSPUSH\n");
+            firth_emit_instruction(result, "INP", NULL, 0);
+            firth_emit_instruction(result, "SPUSH", NULL, 0);
+            result->accumulator_is_top = 1;
+            result->accumulator_known = 0;
         } else if (firth_elt_token_equals(elt, "pop")) {
-            strcat(result->lmsm_assembly, "SPOP\n");
+            firth_emit_instruction(result, "SPOP", NULL, 0);
+            firth_forget_accumulator(result);
         } else if (firth_elt_token_equals(elt, "dup")) {
-            strcat(result->lmsm_assembly, "SDUP\n");
+            firth_emit_instruction(result, "SDUP", NULL, 0);
         } else if (firth_elt_token_equals(elt, "swap")) {
-            strcat(result->lmsm_assembly, "SSWAP\n");
+            firth_emit_instruction(result, "SSWAP", NULL, 0);
+            result->accumulator_is_top = 0;
         } else if (firth_elt_token_equals(elt, "return")) {
-            strcat(result->lmsm_assembly, "RET\n");
+            firth_emit_instruction(result, "RET", NULL, 0);
+            firth_forget_accumulator(result);
+        }
+    } else if (constant && result->accumulator_is_top && next != NULL &&
+               (firth_is_op(next, "+") || firth_is_op(next, "-")) && firth_printed_after_sums(elt, result->address_radix)) {
+        // the top is in the accumulator and the sums are printed, so they are taken there and the total put back
+        // in place of the top, leaving it in the accumulator for the print. The accumulator only stands for the top
+        // when it was pushed from there, after LDI or INP, so ADD and SUB cap as SADD and SSUB do
+        firth_parse_element *op = next;
+        while (1) {
+            char label[24];
+            firth_constant_label(result, value, label);
+            firth_emit_instruction(result, firth_is_op(op, "+") ? "ADD" : "SUB", label, strlen(label));
+            next = op->next_sibling;
+            if (!firth_constant(next, result->address_radix, &value)) {
+                break;
+            }
+            firth_mark_source(next, result);
+            op = next->next_sibling;
         }
+        firth_mark_source(op, result);
+        firth_emit_instruction(result, "SDROP", NULL, 0);
+        firth_emit_instruction(result, "SPUSH", NULL, 0);
+        result->accumulator_known = 0;
     } else if (elt->type == NUMBER) {
-        strcat(result->lmsm_assembly, "LDI ");
-        strcat(result->lmsm_assembly, elt->token->value);
-        strcat(result->lmsm_assembly, "\n");
-        strcat(result->lmsm_assembly, "SPUSH\n");
+        if (!constant || !result->accumulator_known || result->accumulator_value != value) {
+            if (elt->folded) {
+                char text[12];
+                firth_emit_instruction(result, "LDI", text, sprintf(text, "%d", elt->value));
+            } else {
+                firth_emit_instruction(result, "LDI", elt->token->start, elt->token->length);
+            }
+        }
+        firth_emit_instruction(result, "SPUSH", NULL, 0);
+        result->accumulator_is_top = 1;
+        result->accumulator_known = constant;
+        result->accumulator_value = value;
     } else if (elt->type == ZERO_TEST) {
         char if_zero_label[20];
         sprintf(if_zero_label, "if_zero_%d", result->label_num++);
@@ -261,73 +925,72 @@ void firth_code_gen_elt(firth_parse_element * elt, firth_compilation_result *res
         sprintf(end_zero_label, "end_zero_%d", result->label_num++);
 
         // branch if top of stack zero
-        strcat(result->lmsm_assembly, "SPOP\nBRZ ");
-        if (elt->left_children->first) {
-            strcat(result->lmsm_assembly, if_zero_label);
-        } else {
-            strcat(result->lmsm_assembly, end_zero_label);
-        }
-        strcat(result->lmsm_assembly, "\n");
+        firth_emit_instruction(result, "SPOP", NULL, 0);
+        char *target = elt->left_children->first ? if_zero_label : end_zero_label;
+        firth_emit_instruction(result, "BRZ", target, strlen(target));
+        firth_forget_accumulator(result);
 
         // generate else
         if (elt->right_children->first) {
             struct firth_parse_element *child = elt->right_children->first;
             while (child != NULL) {
-                firth_code_gen_elt(child, result);
-                child = child->next_sibling;
+                child = firth_code_gen_elt(child, result);
             }
         }
 
-        // jump to end of zero condition
-        strcat(result->lmsm_assembly, "BRA ");
-        strcat(result->lmsm_assembly, end_zero_label);
-        strcat(result->lmsm_assembly, "\n");
+        // jump to end of zero condition, unless the else never gets there
+        if (firth_falls_through(elt->right_children)) {
+            firth_mark_source(elt, result);
+            firth_emit_instruction(result, "BRA", end_zero_label, strlen(end_zero_label));
+        }
 
         // generate if zero condition
         if (elt->left_children->first) {
-            strcat(result->lmsm_assembly, if_zero_label);
-            strcat(result->lmsm_assembly, " ");
+            firth_emit_label(result, if_zero_label, strlen(if_zero_label));
             struct firth_parse_element *child = elt->left_children->first;
             while (child != NULL) {
-                firth_code_gen_elt(child, result);
-                child = child->next_sibling;
+                child = firth_code_gen_elt(child, result);
             }
         }
 
-        // label end of zero conditional
-        strcat(result->lmsm_assembly, end_zero_label);
-        strcat(result->lmsm_assembly, " ");
+        // label end of zero conditional, if anything comes out there
+        if (firth_elt_falls_through(elt)) {
+            firth_emit_label(result, end_zero_label, strlen(end_zero_label));
+        }
     } else if (elt->type == CALL) {
-        strcat(result->lmsm_assembly, "CALL ");
-        strcat(result->lmsm_assembly, elt->token->value);
-        strcat(result->lmsm_assembly, "\n");
+        // a tail call returns straight to this function's caller
+        firth_emit_instruction(result, elt->tail ? "BRA" : "CALL", elt->token->start, elt->token->length);
+        firth_forget_accumulator(result);
     } else if (elt->type == DEF) {
         // function label
-        strcat(result->lmsm_assembly, elt->name->value);
-        strcat(result->lmsm_assembly, " ");
+        firth_emit_label(result, elt->name->start, elt->name->length);
         // function body
         if (elt->left_children->first) {
             struct firth_parse_element *child = elt->left_children->first;
             while (child != NULL) {
-                firth_code_gen_elt(child, result);
-                child = child->next_sibling;
+                child = firth_code_gen_elt(child, result);
             }
         }
-        // always append a RET
-        strcat(result->lmsm_assembly, "RET\n");
+        // append a RET, unless every way through the body has already left by a tail call or a return
+        if (firth_falls_through(elt->left_children)) {
+            firth_mark_source(elt, result);
+            firth_emit_instruction(result, "RET", NULL, 0);
+        }
+        firth_forget_accumulator(result);
     }
-
+    return next;
 }
 
 void firth_code_gen_top_level(firth_compilation_result *result) {
     struct firth_parse_element *elt = result->root_elements->first;
     while (elt != NULL) {
         if (elt->type != DEF) {
-            firth_code_gen_elt(elt, result);
+            elt = firth_code_gen_elt(elt, result);
+        } else {
+            elt = elt->next_sibling;
         }
-        elt = elt->next_sibling;
     }
-    strcat(result->lmsm_assembly, "HLT\n");
+    firth_emit_instruction(result, "HLT", NULL, 0);
 }
 
 void firth_code_gen_functions(firth_compilation_result *result) {
@@ -340,70 +1003,110 @@ void firth_code_gen_functions(firth_compilation_result *result) {
     }
 }
 
+// the cells ADD and SUB take constants from, after everything that runs
+void firth_code_gen_constants(firth_compilation_result *result) {
+    for (int i = 0; i < result->constant_count; ++i) {
+        char label[24];
+        char value[12];
+        sprintf(label, "constant_%d", result->constants[i]);
+        firth_emit_label(result, label, strlen(label));
+        firth_emit_instruction(result, "DAT", value, sprintf(value, "%d", result->constants[i]));
+    }
+}
+
 void firth_code_gen(firth_compilation_result *result) {
     if (result->error == NULL) {
         firth_code_gen_top_level(result);
         firth_code_gen_functions(result);
+        firth_code_gen_constants(result);
     }
 }
 
 //======================================================
 // Entry Point
 //======================================================
-void firth_delete_tokens(firth_tokens *tokens) {
-    firth_token *token = tokens->start;
-    while (token != NULL) {
-        firth_token *to_delete = token;
-        token = to_delete->next;
-        free(to_delete);
-    }
-    free(tokens->original_src);
-}
-
 void firth_delete_compilation_result(firth_compilation_result * result){
-    firth_delete_exprs(result->root_elements);
-    firth_delete_tokens(result->tokens);
+    // the tokens and every element
+    lmsm_arena_free(&result->arena);
+    free(result->source_marks);
+    free(result->constants);
+    free(result->lmsm_assembly);
     free(result);
 }
 
-void firth_delete_expr(firth_parse_element *elt) {
-    if (elt->left_children) {
-        firth_delete_exprs(elt->left_children);
+int firth_source_location(firth_compilation_result *result, int assembly_line, int *line, int *column) {
+    // binary search for the last mark at or before the assembly line
+    int low = 0;
+    int high = result->source_mark_count - 1;
+    int found = -1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (result->source_marks[mid].assembly_line <= assembly_line) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
     }
-    if (elt->right_children) {
-        firth_delete_exprs(elt->right_children);
+    if (found == -1) {
+        return 0;
     }
-    free(elt);
+    *line = result->source_marks[found].line;
+    *column = result->source_marks[found].column;
+    return 1;
 }
 
-void firth_delete_exprs(firth_parse_elements *elts) {
-    if (elts->first) {
-        firth_parse_element *current = elts->first;
-        while (current != NULL) {
-            firth_parse_element *to_delete = current;
-            current = to_delete->next_sibling;
-            firth_delete_expr(to_delete);
+void firth_map_source(firth_compilation_result *result, asm_compilation_result *assembly) {
+    for (int slot = 0; slot < assembly->code_size; ++slot) {
+        asm_source_location *location = &assembly->source_map[slot];
+        if (location->line && !firth_source_location(result, location->line, &location->line, &location->column)) {
+            *location = (asm_source_location) {0, 0};
         }
     }
 }
 
-firth_compilation_result *firth_compile(char *firth_src) {
+firth_compilation_result *firth_compile_program(char *firth_src, int code_size, int address_radix,
+                                                asm_compilation_result *assembly, int emit_text) {
 
     firth_compilation_result *result = calloc(1, sizeof(firth_compilation_result));
+    result->assembly_line = 1;
+    result->code_size = code_size;
+    result->address_radix = address_radix;
+    // a module exports every function, for other modules to call
+    result->keep_functions = assembly && assembly->relocatable;
+    result->assembly = assembly;
+    result->emit_text = emit_text;
+    if (emit_text) {
+        firth_emit(result, "");
+    }
 
-    void *root_elements = calloc(1, sizeof(firth_parse_elements));
-    result->root_elements = root_elements;
-
-    firth_tokens *tokens = firth_tokenize(firth_src);
-    result->tokens = tokens;
+    result->root_elements = firth_make_elements(result);
+    result->tokens = firth_tokenize(firth_src, &result->arena);
+    firth_parse(result->tokens, result);
 
-    while (firth_has_more_tokens(tokens)) {
-        firth_add_element(root_elements, firth_parse_elt(tokens, result));
+    if (result->error == NULL) {
+        firth_optimize(result);
     }
-
     firth_code_gen(result);
+    if (result->error == NULL && assembly) {
+        asm_assemble_instructions(assembly);
+    }
+    // the assembly belongs to the caller and can go before this result does
+    result->assembly = NULL;
+    result->last_instruction = NULL;
+    result->pending_label = NULL;
 
     return result;
 }
 
+firth_compilation_result *firth_compile(char *firth_src) {
+    return firth_compile_program(firth_src, CODE_SIZE, ADDRESS_RADIX, NULL, 1);
+}
 
+firth_compilation_result *firth_compile_for(char *firth_src, int code_size, int address_radix) {
+    return firth_compile_program(firth_src, code_size, address_radix, NULL, 1);
+}
+
+firth_compilation_result *firth_compile_to(char *firth_src, asm_compilation_result *assembly, int emit_text) {
+    return firth_compile_program(firth_src, assembly->code_size, assembly->address_radix, assembly, emit_text);
+}
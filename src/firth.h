@@ -1,15 +1,24 @@
 #ifndef LMSM_FIRTH_H
 #define LMSM_FIRTH_H
 
+#include <stddef.h>
+#include "arena.h"
+#include "assembler.h"
+
+#define FIRTH_INLINE_SLOTS 8   // the largest function body copied over a call that it makes the program bigger
+
 typedef struct firth_token {
-    char *value;
-    struct firth_token *next;
+    const char *start;  // a slice of the source, which is never copied or modified
+    int length;
+    int line;      // source line of the token, starting at 1
+    int column;    // source column of the token, starting at 1
+    int number;
 } firth_token;
 
 typedef struct firth_tokens {
-    struct firth_token *start;
-    struct firth_token *current;
-    char * original_src;
+    firth_token *start;  // every token of the source, in order
+    int count;
+    int current;         // index of the next token to parse
 } firth_tokens;
 
 typedef enum firth_parse_element_type {
@@ -26,6 +35,9 @@ typedef struct firth_parse_element {
     firth_token *token;  // start token
     firth_token *name;   // name, if any
     firth_parse_element_type type;  // type
+    int value;      // of a NUMBER rewritten by folding, replacing the text of its token
+    int folded;
+    int tail;       // a CALL with only the RET of its function after it
 
     struct firth_parse_element *next_sibling; // next element in the Firth program
 
@@ -38,17 +50,64 @@ typedef struct firth_parse_elements {
     struct firth_parse_element *last;
 } firth_parse_elements;
 
+//===================================================================
+//  Maps a line of generated assembly back to the Firth source
+//===================================================================
+typedef struct firth_source_mark {
+    int assembly_line;  // first assembly line generated for the element
+    int line;           // Firth source line of the element
+    int column;         // Firth source column of the element
+} firth_source_mark;
+
 typedef struct firth_compilation_result {
+    lmsm_arena arena;           // the tokens and parse elements, freed with the result
     firth_tokens * tokens;
     firth_parse_elements * root_elements;
-    char lmsm_assembly[4000];   // the assembly for this program
+    char *lmsm_assembly;        // the assembly for this program, NUL terminated, NULL if no text was asked for
+    size_t assembly_length;
+    size_t assembly_capacity;
+    int emit_text;
+    asm_compilation_result *assembly;   // while compiling, the instructions are built straight into this if set
+    asm_instruction *last_instruction;
+    char *pending_label;        // the label of the next instruction, in the assembly's arena
+    int label_pending;          // whether a label is waiting for the next instruction, with or without the text
     char * error;         // any error that occurred (e.g. a missing label)
     int label_num;
+    int code_size;              // of the layout compiled for, inlining leaves room in it
+    int address_radix;          // of the layout compiled for, only constants an LDI can load there are folded
+    int keep_functions;         // whether to generate functions nothing calls
+    int removed_functions;      // functions left out as nothing calls them
+    int removed_slots;          // the code they would have taken
+    firth_source_mark *source_marks;  // line table, ordered by assembly line
+    int source_mark_count;
+    int source_mark_capacity;
+    int assembly_line;          // the assembly line currently being generated
+    int accumulator_is_top;     // whether the accumulator holds the top of the stack, as generated so far
+    int accumulator_known;      // whether it holds accumulator_value
+    int accumulator_value;
+    int *constants;             // the values given a DAT cell, in the order they were needed
+    int constant_count;
+    int constant_capacity;
 } firth_compilation_result;
 
-// compiles a Firth program to LMSM assembly
+// compiles a Firth program to LMSM assembly, the tokens of the result point into firth_src
 firth_compilation_result * firth_compile(char *firth_src);
 
+// compiles a Firth program to LMSM assembly for a layout, see lmsm_configure
+firth_compilation_result * firth_compile_for(char *firth_src, int code_size, int address_radix);
+
+// compiles a Firth program straight to the instructions of assembly (a result from asm_make_sized_compilation_result,
+// flagged optimized or relocatable as wanted) and assembles them, without parsing any text, only generating the text
+// as well if emit_text is set. Firth errors are in the Firth result, assembly errors in assembly->error
+firth_compilation_result * firth_compile_to(char *firth_src, asm_compilation_result *assembly, int emit_text);
+
 void firth_delete_compilation_result(firth_compilation_result * result);
 
+// finds the Firth source location that generated the given assembly line, returns 0 if unknown
+int firth_source_location(firth_compilation_result *result, int assembly_line, int *line, int *column);
+
+// points the source map of the program assembled from this result at the Firth source rather than the generated
+// assembly, for a debug map that outlives the result
+void firth_map_source(firth_compilation_result *result, asm_compilation_result *assembly);
+
 #endif // LMSM_FIRTH_H
\ No newline at end of file
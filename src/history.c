@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+
+//======================================================
+// Constructors/Destructors
+//======================================================
+
+lmsm_history *lmsm_history_create(int max_steps) {
+    lmsm_history *history = calloc(1, sizeof(lmsm_history));
+    history->max_entries = max_steps >= 16 ? max_steps : HISTORY_DEFAULT_STEPS;
+    history->recording = -1;
+    return history;
+}
+
+void lmsm_history_delete(lmsm_history *history) {
+    free(history->entries);
+    free(history);
+}
+
+void lmsm_history_clear(lmsm_history *history) {
+    history->entry_count = 0;
+    history->steps = 0;
+    history->recording = -1;
+}
+
+//======================================================
+// Recording
+//======================================================
+
+void lmsm_history_forget_oldest(lmsm_history *history) {
+    int drop = history->entry_count / 4;
+    // never keep the extra writes of a step whose main entry is gone
+    while (drop < history->entry_count &&
+           history->entries[drop].continuation) {
+        drop++;
+    }
+    for (int i = 0; i < drop; ++i) {
+        if (!history->entries[i].continuation) {
+            history->steps--;
+        }
+    }
+    memmove(history->entries, history->entries + drop,
+            (history->entry_count - drop) * sizeof(lmsm_history_entry));
+    history->entry_count -= drop;
+    if (history->recording != -1) {
+        history->recording -= drop;
+    }
+}
+
+lmsm_history_entry *lmsm_history_push(lmsm_history *history) {
+    if (history->entry_count == history->entry_capacity) {
+        if (history->entry_capacity < history->max_entries) {
+            int capacity = history->entry_capacity ? history->entry_capacity * 2 : 4096;
+            history->entry_capacity = capacity < history->max_entries ? capacity : history->max_entries;
+            history->entries = realloc(history->entries, history->entry_capacity * sizeof(lmsm_history_entry));
+        } else {
+            lmsm_history_forget_oldest(history);
+        }
+    }
+    return &history->entries[history->entry_count++];
+}
+
+void lmsm_history_begin_step(lmsm_history *history, lmsm *our_little_machine) {
+    lmsm_history_entry *entry = lmsm_history_push(history);
+    history->recording = history->entry_count - 1;
+    entry->slot = -1;
+    entry->old_value = 0;
+    entry->program_counter = (short) our_little_machine->program_counter;
+    entry->accumulator = our_little_machine->accumulator;
+    entry->current_instruction = our_little_machine->current_instruction;
+    entry->status = our_little_machine->status;
+    entry->continuation = 0;
+    history->stack_pointer = our_little_machine->stack_pointer;
+    history->return_address_pointer = our_little_machine->return_address_pointer;
+}
+
+void lmsm_history_end_step(lmsm_history *history, lmsm *our_little_machine) {
+    lmsm_history_entry *entry = &history->entries[history->recording];
+    entry->stack_pointer_delta = our_little_machine->stack_pointer - history->stack_pointer;
+    entry->return_address_delta = our_little_machine->return_address_pointer - history->return_address_pointer;
+    history->recording = -1;
+    history->steps++;
+}
+
+void lmsm_history_note_write(lmsm_history *history, int slot, int old_value) {
+    if (history->recording == -1) {
+        return;
+    }
+    lmsm_history_entry *entry = &history->entries[history->recording];
+    if (entry->slot == -1) {
+        entry->slot = (short) slot;
+        entry->old_value = old_value;
+    } else if (entry->slot != slot) {
+        // only SSWAP changes two slots in one step
+        lmsm_history_entry *extra = lmsm_history_push(history);
+        extra->slot = (short) slot;
+        extra->old_value = old_value;
+        extra->continuation = 1;
+    }
+}
+
+//======================================================
+// Rewinding
+//======================================================
+
+long lmsm_history_rewind(lmsm_history *history, lmsm *our_little_machine, long count) {
+    long undone = 0;
+    while (undone < count && history->entry_count > 0) {
+        int instruction = our_little_machine->current_instruction;
+        if (instruction == lmsm_instruction(our_little_machine, 9, 1) && our_little_machine->input_position > 0 &&
+            our_little_machine->error_code != ERROR_INPUT_EXHAUSTED) {
+            // the step being undone was an INP, give its value back
+            our_little_machine->input_position--;
+        } else if (instruction == lmsm_instruction(our_little_machine, 9, 2) &&
+                   our_little_machine->error_code != ERROR_OUTPUT_EXHAUSTED) {
+            // the step being undone was an OUT, every value is written with a trailing space
+            int length = our_little_machine->output_length - 1;
+            while (length > 0 && our_little_machine->output_buffer[length - 1] != ' ') {
+                length--;
+            }
+            our_little_machine->output_length = length > 0 ? length : 0;
+            our_little_machine->output_buffer[our_little_machine->output_length] = '\0';
+        }
+        lmsm_history_entry *entry = &history->entries[--history->entry_count];
+        while (entry->continuation) {
+            our_little_machine->memory[entry->slot] = entry->old_value;
+            entry = &history->entries[--history->entry_count];
+        }
+        if (entry->slot != -1) {
+            our_little_machine->memory[entry->slot] = entry->old_value;
+        }
+        our_little_machine->stack_pointer -= entry->stack_pointer_delta;
+        our_little_machine->return_address_pointer -= entry->return_address_delta;
+        our_little_machine->program_counter = entry->program_counter;
+        our_little_machine->accumulator = entry->accumulator;
+        our_little_machine->current_instruction = entry->current_instruction;
+        our_little_machine->status = (machine_status) entry->status;
+        our_little_machine->error_code = ERROR_NONE;
+        our_little_machine->breakpoint_hit = -1;
+        history->steps--;
+        undone++;
+    }
+    return undone;
+}
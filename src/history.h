@@ -0,0 +1,56 @@
+#ifndef LMSM_HISTORY_H
+#define LMSM_HISTORY_H
+
+#include "lmsm.h"
+
+#define HISTORY_DEFAULT_STEPS (2 * 1024 * 1024)
+
+//===================================================================
+//  One undo entry per step, holding only what the step changed
+//===================================================================
+
+typedef struct lmsm_history_entry {
+    int old_value;                     // previous contents of the written slot
+    int current_instruction;           // wide mode words need more than 16 bits
+    short slot;                        // slot written by the step, -1 if none
+    short program_counter;
+    // the output length is not kept, undoing an OUT drops the last value from the output
+    signed int accumulator : 18;       // +/-99999 in wide mode
+    unsigned int status : 2;
+    signed int stack_pointer_delta : 3;
+    signed int return_address_delta : 3;
+    unsigned int continuation : 1;     // the entry holds an extra write of the step before it
+} lmsm_history_entry;
+
+typedef struct lmsm_history {
+    lmsm_history_entry *entries;
+    int entry_count;
+    int entry_capacity;
+    int max_entries;                   // oldest steps are forgotten past this
+    long steps;                        // steps that can be undone
+    int recording;                     // index of the entry for the step in progress, -1 between steps
+    int stack_pointer;                 // pointers before the step in progress
+    int return_address_pointer;
+} lmsm_history;
+
+//=====================================================
+// API
+//=====================================================
+
+lmsm_history *lmsm_history_create(int max_steps);
+
+void lmsm_history_delete(lmsm_history *history);
+
+void lmsm_history_clear(lmsm_history *history);
+
+// called by lmsm_step around each instruction
+void lmsm_history_begin_step(lmsm_history *history, lmsm *our_little_machine);
+void lmsm_history_end_step(lmsm_history *history, lmsm *our_little_machine);
+
+// called before a step overwrites a slot with a different value
+void lmsm_history_note_write(lmsm_history *history, int slot, int old_value);
+
+// undoes up to count steps, returns the number undone
+long lmsm_history_rewind(lmsm_history *history, lmsm *our_little_machine, long count);
+
+#endif //LMSM_HISTORY_H
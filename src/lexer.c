@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lexer.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//======================================================
+// Classification
+//======================================================
+
+// one bit per byte of a block, bit 0 for the first byte, classified 32 bytes at a time when built with -mavx2,
+// 16 with SSE2 (any x86-64) and a byte at a time otherwise
+typedef struct lmsm_lexer_masks {
+    uint64_t space;     // any separator
+    uint64_t newline;
+    uint64_t digit;
+} lmsm_lexer_masks;
+
+#if defined(__AVX2__)
+
+void lmsm_lexer_classify(const char *block, lmsm_lexer_masks *masks) {
+    masks->space = masks->newline = masks->digit = 0;
+    for (int i = 0; i < LEXER_BLOCK_SIZE; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+        __m256i newline = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'));
+        __m256i space = _mm256_or_si256(_mm256_or_si256(newline, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t')),
+                                                        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))));
+        // a digit is at most 9 above '0', unsigned
+        __m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8('0'));
+        __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(9)), offset);
+        masks->space |= (uint64_t) (uint32_t) _mm256_movemask_epi8(space) << i;
+        masks->newline |= (uint64_t) (uint32_t) _mm256_movemask_epi8(newline) << i;
+        masks->digit |= (uint64_t) (uint32_t) _mm256_movemask_epi8(digit) << i;
+    }
+}
+
+#elif defined(__SSE2__)
+
+void lmsm_lexer_classify(const char *block, lmsm_lexer_masks *masks) {
+    masks->space = masks->newline = masks->digit = 0;
+    for (int i = 0; i < LEXER_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+        __m128i newline = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+        __m128i space = _mm_or_si128(_mm_or_si128(newline, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t')),
+                                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+        __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8('0'));
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(9)), offset);
+        masks->space |= (uint64_t) (uint32_t) _mm_movemask_epi8(space) << i;
+        masks->newline |= (uint64_t) (uint32_t) _mm_movemask_epi8(newline) << i;
+        masks->digit |= (uint64_t) (uint32_t) _mm_movemask_epi8(digit) << i;
+    }
+}
+
+#else
+
+void lmsm_lexer_classify(const char *block, lmsm_lexer_masks *masks) {
+    masks->space = masks->newline = masks->digit = 0;
+    for (int i = 0; i < LEXER_BLOCK_SIZE; ++i) {
+        char c = block[i];
+        uint64_t bit = (uint64_t) 1 << i;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            masks->space |= bit;
+        }
+        if (c == '\n') {
+            masks->newline |= bit;
+        }
+        if ('0' <= c && c <= '9') {
+            masks->digit |= bit;
+        }
+    }
+}
+
+#endif
+
+//======================================================
+// Tokenizing
+//======================================================
+
+// the bits below the given one
+uint64_t lmsm_lexer_below(int bit) {
+    return bit >= LEXER_BLOCK_SIZE ? ~(uint64_t) 0 : ((uint64_t) 1 << bit) - 1;
+}
+
+// whether the bits of a token from first up to (not including) last are digits, past any leading '-'
+int lmsm_lexer_digits(const char *block, uint64_t digits, int first, int last, int token_start) {
+    first += token_start && block[first] == '-';
+    uint64_t body = lmsm_lexer_below(last) & ~lmsm_lexer_below(first);
+    return (digits & body) == body;
+}
+
+void lmsm_lexer_close(lmsm_lexer *lexer, lmsm_token *token, int end) {
+    token->length = end - token->start;
+    // a lone '-' is the only token whose digits can all be there without being a number
+    token->number = lexer->number && !(token->length == 1 && lexer->src[token->start] == '-');
+}
+
+void lmsm_lexer_block(lmsm_lexer *lexer, size_t base, const char *block) {
+    lmsm_lexer_masks masks;
+    lmsm_lexer_classify(block, &masks);
+    uint64_t inside = ~masks.space;
+    uint64_t previous = inside << 1 | (uint64_t) lexer->in_token;
+    uint64_t starts = inside & ~previous;
+    uint64_t ends = ~inside & previous;
+    uint64_t newlines = masks.newline;
+
+    if (lexer->in_token) {
+        // starts and ends alternate, so the first end closes the token left open
+        lmsm_token *token = &lexer->tokens[lexer->count - 1];
+        int end = ends ? __builtin_ctzll(ends) : LEXER_BLOCK_SIZE;
+        lexer->number = lexer->number && lmsm_lexer_digits(block, masks.digit, 0, end, 0);
+        if (ends) {
+            lmsm_lexer_close(lexer, token, (int) (base + end));
+            ends &= ends - 1;
+        }
+    }
+    // the tokens are ints too, so the state is kept in locals the stores cannot alias
+    lmsm_token *token = lexer->tokens + lexer->count;
+    int line = lexer->line;
+    size_t line_start = lexer->line_start;
+    int number = lexer->number;
+    while (starts) {
+        int start = __builtin_ctzll(starts);
+        // newlines are rare next to tokens, so step through the ones before this token
+        uint64_t before = newlines & lmsm_lexer_below(start);
+        newlines ^= before;
+        while (before) {
+            line++;
+            line_start = base + __builtin_ctzll(before) + 1;
+            before &= before - 1;
+        }
+        token->start = (int) (base + start);
+        token->line = line;
+        token->column = (int) (base + start - line_start) + 1;
+        int end = ends ? __builtin_ctzll(ends) : LEXER_BLOCK_SIZE;
+        number = lmsm_lexer_digits(block, masks.digit, start, end, 1);
+        if (ends) {
+            token->length = end - start;
+            token->number = number && !(token->length == 1 && block[start] == '-');
+            ends &= ends - 1;
+        }
+        token++;
+        starts &= starts - 1;
+    }
+    while (newlines) {
+        line++;
+        line_start = base + __builtin_ctzll(newlines) + 1;
+        newlines &= newlines - 1;
+    }
+    lexer->count = (int) (token - lexer->tokens);
+    lexer->line = line;
+    lexer->line_start = line_start;
+    lexer->number = number;
+    lexer->in_token = (int) (inside >> 63);
+}
+
+//======================================================
+// Main API
+//======================================================
+
+void lmsm_lexer_init(lmsm_lexer *lexer, const char *src, size_t length, int first_line) {
+    memset(lexer, 0, sizeof(lmsm_lexer));
+    lexer->src = src;
+    lexer->length = length;
+    lexer->line = first_line;
+}
+
+int lmsm_lexer_fill(lmsm_lexer *lexer, lmsm_token *tokens, int capacity) {
+    lexer->tokens = tokens;
+    lexer->count = 0;
+    if (lexer->in_token) {
+        tokens[lexer->count++] = lexer->open;
+    }
+    // a block holds at most LEXER_BLOCK_SIZE / 2 token starts
+    while (lexer->next < lexer->length && lexer->count + LEXER_BLOCK_SIZE / 2 < capacity) {
+        size_t base = lexer->next;
+        if (base + LEXER_BLOCK_SIZE <= lexer->length) {
+            lmsm_lexer_block(lexer, base, lexer->src + base);
+        } else {
+            // the tail is padded with separators rather than read past the end
+            char block[LEXER_BLOCK_SIZE];
+            memset(block, ' ', LEXER_BLOCK_SIZE);
+            memcpy(block, lexer->src + base, lexer->length - base);
+            lmsm_lexer_block(lexer, base, block);
+        }
+        lexer->next = base + LEXER_BLOCK_SIZE;
+    }
+    if (lexer->in_token && lexer->next >= lexer->length) {
+        lmsm_lexer_close(lexer, &tokens[lexer->count - 1], (int) lexer->length);
+        lexer->in_token = 0;
+    } else if (lexer->in_token) {
+        lexer->open = tokens[--lexer->count];
+    }
+    return lexer->count;
+}
+
+lmsm_token *lmsm_lex(const char *src, size_t length, int first_line, int *count) {
+    lmsm_lexer lexer;
+    lmsm_lexer_init(&lexer, src, length, first_line);
+    int capacity = 1024;
+    lmsm_token *tokens = malloc(capacity * sizeof(lmsm_token));
+    int lexed;
+    *count = 0;
+    while ((lexed = lmsm_lexer_fill(&lexer, tokens + *count, capacity - *count)) > 0) {
+        *count += lexed;
+        if (capacity - *count < LEXER_MIN_WINDOW) {
+            capacity *= 2;
+            tokens = realloc(tokens, capacity * sizeof(lmsm_token));
+        }
+    }
+    return tokens;
+}
@@ -0,0 +1,55 @@
+#ifndef LMSM_LEXER_H
+#define LMSM_LEXER_H
+
+#include <stddef.h>
+
+#define LEXER_BLOCK_SIZE 64
+#define LEXER_MIN_WINDOW (LEXER_BLOCK_SIZE + 2)
+
+//===================================================================
+//  The whitespace separated tokens of assembly and Firth source.
+//  Spaces, tabs, carriage returns and newlines all separate tokens,
+//  so CRLF sources read the same as LF ones.
+//===================================================================
+
+typedef struct lmsm_token {
+    int start;      // offset of the token in the source
+    int length;
+    int line;       // source line of the token
+    int column;     // source column of the token, starting at 1
+    int number;     // whether the token is a decimal number, with an optional leading '-'
+} lmsm_token;
+
+//===================================================================
+//  Lexing state, the source is read LEXER_BLOCK_SIZE bytes at a time
+//  into windows of tokens
+//===================================================================
+
+typedef struct lmsm_lexer {
+    const char *src;
+    size_t length;
+    size_t next;            // offset of the next block
+    int line;
+    size_t line_start;      // offset of the first char of the current line
+    int in_token;           // whether the last block ended inside a token
+    int number;             // whether that token has been a number so far
+    lmsm_token open;        // the token a window ended inside, carried into the next one
+    lmsm_token *tokens;     // the window being filled
+    int count;
+} lmsm_lexer;
+
+//=====================================================
+// API
+//=====================================================
+
+void lmsm_lexer_init(lmsm_lexer *lexer, const char *src, size_t length, int first_line);
+
+// lexes the next tokens into tokens[capacity], capacity must be at least LEXER_MIN_WINDOW,
+// returns how many were lexed, 0 at the end of the source
+int lmsm_lexer_fill(lmsm_lexer *lexer, lmsm_token *tokens, int capacity);
+
+// tokenizes length chars of src, numbering lines from first_line, returns a flat array of *count tokens
+// allocated with malloc
+lmsm_token *lmsm_lex(const char *src, size_t length, int first_line, int *count);
+
+#endif //LMSM_LEXER_H
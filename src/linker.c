@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "linker.h"
+#include "firth.h"
+#include "source.h"
+
+//======================================================
+// Modules
+//======================================================
+
+char *lmsm_linker_object_path(char *path) {
+    char *object_path = calloc(strlen(path) + strlen(".lmo") + 1, sizeof(char));
+    return strcat(strcat(object_path, path), ".lmo");
+}
+
+int lmsm_linker_is_firth(char *name) {
+    size_t length = strlen(name);
+    return length > strlen(".firth") && strcmp(name + length - strlen(".firth"), ".firth") == 0;
+}
+
+asm_compilation_result *lmsm_linker_assemble(lmsm_linker *linker, char *src, char *name) {
+    asm_compilation_result *result;
+    if (lmsm_linker_is_firth(name)) {
+        // straight to instructions, nothing here shows the assembly text
+        result = asm_make_sized_compilation_result(linker->code_size, linker->address_radix);
+        result->relocatable = 1;
+        firth_compilation_result *firth = firth_compile_to(src, result, 0);
+        if (firth->error) {
+            snprintf(linker->error, LINKER_ERROR_SIZE, "Compilation Error in %s: %s", name, firth->error);
+            firth_delete_compilation_result(firth);
+            asm_delete_compilation_result(result);
+            return NULL;
+        }
+        // an object keeps the source map, but not the Firth result that reads it
+        firth_map_source(firth, result);
+        firth_delete_compilation_result(firth);
+    } else {
+        result = asm_assemble_module(src, linker->code_size, linker->address_radix);
+    }
+    if (result->error) {
+        snprintf(linker->error, LINKER_ERROR_SIZE, "Assembly Error in %s: %s", name, result->error);
+        asm_delete_compilation_result(result);
+        return NULL;
+    }
+    return result;
+}
+
+// a view of a module assembled in this process, the tables are shared with the result
+void lmsm_module_from_result(lmsm_module *module, asm_compilation_result *result) {
+    module->result = result;
+    module->code = result->code;
+    module->length = lmsm_object_code_length(result);
+    module->exports = result->symbols;
+    module->imports = result->imports;
+    module->relocations = result->relocations;
+    module->relocation_count = result->relocation_count;
+}
+
+// a view of a mapped module, returns 0 if the object is not a sound relocatable module for the linker
+int lmsm_module_from_object(lmsm_linker *linker, lmsm_module *module, lmsm_object *object) {
+    lmsm_object_header *header = object->header;
+    if (!(header->flags & OBJECT_RELOCATABLE) || header->address_radix != (unsigned int) linker->address_radix ||
+        (header->string_table_size > 0 && object->strings[header->string_table_size - 1] != '\0')) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < header->symbol_count; ++i) {
+        lmsm_object_symbol *symbol = &object->symbols[i];
+        if (symbol->name >= header->string_table_size || symbol->offset < 0 ||
+            symbol->offset >= (int) header->code_length) {
+            return 0;
+        }
+        asm_symbol_table_add(&module->arena, &module->exports, object->strings + symbol->name, symbol->offset);
+    }
+    for (unsigned int i = 0; i < header->import_count; ++i) {
+        if (object->imports[i] >= header->string_table_size ||
+            !asm_symbol_table_add(&module->arena, &module->imports, object->strings + object->imports[i], (int) i)) {
+            return 0;
+        }
+    }
+    for (unsigned int i = 0; i < header->relocation_count; ++i) {
+        asm_relocation *relocation = &object->relocations[i];
+        if (relocation->slot < 0 || relocation->slot >= (int) header->code_length ||
+            relocation->import < -1 || relocation->import >= (int) header->import_count) {
+            return 0;
+        }
+    }
+    module->object = object;
+    module->code = object->code;
+    module->length = (int) header->code_length;
+    module->relocations = object->relocations;
+    module->relocation_count = (int) header->relocation_count;
+    return 1;
+}
+
+void lmsm_module_delete(lmsm_module *module) {
+    if (module->object) {
+        lmsm_object_close(module->object);
+    }
+    if (module->result) {
+        asm_delete_compilation_result(module->result);
+    }
+    lmsm_arena_free(&module->arena);
+    free(module);
+}
+
+int lmsm_linker_newer(struct timespec first, struct timespec second) {
+    return first.tv_sec > second.tv_sec || (first.tv_sec == second.tv_sec && first.tv_nsec >= second.tv_nsec);
+}
+
+lmsm_module *lmsm_linker_build_library(lmsm_linker *linker, char *path, struct timespec modified) {
+    lmsm_module *module = calloc(1, sizeof(lmsm_module));
+    module->path = lmsm_arena_strndup(&module->arena, path, strlen(path));
+    module->modified = modified;
+
+    char *object_path = lmsm_linker_object_path(path);
+    struct stat info;
+    if (stat(object_path, &info) == 0 && lmsm_linker_newer(info.st_mtim, modified)) {
+        lmsm_object *object = lmsm_object_open(object_path);
+        if (object && lmsm_module_from_object(linker, module, object)) {
+            free(object_path);
+            return module;
+        }
+        if (object) {
+            lmsm_object_close(object);
+        }
+        // a stale or foreign .lmo, start the tables again and assemble the source
+        module->exports = (asm_symbol_table) {0};
+        module->imports = (asm_symbol_table) {0};
+    }
+
+    lmsm_source *source = lmsm_source_open(path);
+    if (source == NULL) {
+        snprintf(linker->error, LINKER_ERROR_SIZE, "Unknown file: '%s'", path);
+        lmsm_module_delete(module);
+        free(object_path);
+        return NULL;
+    }
+    unsigned long long source_hash = lmsm_object_hash(source->text, source->length);
+    asm_compilation_result *result = lmsm_linker_assemble(linker, source->text, path);
+    lmsm_source_close(source);
+    if (result == NULL) {
+        lmsm_module_delete(module);
+        free(object_path);
+        return NULL;
+    }
+    lmsm_module_from_result(module, result);
+    // the next process can map this instead, not being able to write it only costs that
+    lmsm_object_write(result, 0, source_hash, object_path);
+    free(object_path);
+    return module;
+}
+
+lmsm_module *lmsm_linker_library(lmsm_linker *linker, char *path) {
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        snprintf(linker->error, LINKER_ERROR_SIZE, "Unknown file: '%s'", path);
+        return NULL;
+    }
+    lmsm_module **link = &linker->libraries;
+    while (*link != NULL && strcmp((*link)->path, path) != 0) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        lmsm_module *cached = *link;
+        if (cached->modified.tv_sec == info.st_mtim.tv_sec && cached->modified.tv_nsec == info.st_mtim.tv_nsec) {
+            return cached;
+        }
+        *link = cached->next;
+        lmsm_module_delete(cached);
+    }
+    lmsm_module *module = lmsm_linker_build_library(linker, path, info.st_mtim);
+    if (module) {
+        module->next = linker->libraries;
+        linker->libraries = module;
+    }
+    return module;
+}
+
+//======================================================
+// Linking
+//======================================================
+
+// the slot an import resolves to, or -1 after reporting the undefined label
+int lmsm_link_resolve(lmsm_linker *linker, lmsm_module **modules, int module_count, int *bases,
+                      int *order, int *included, int *next_base, char *name) {
+    for (int i = 0; i < module_count; ++i) {
+        asm_symbol *symbol = asm_symbol_table_find(&modules[i]->exports, name);
+        if (symbol == NULL) {
+            continue;
+        }
+        if (bases[i] == -1) {
+            // archive style, a library is only laid out once something needs it
+            bases[i] = *next_base;
+            *next_base += modules[i]->length;
+            order[(*included)++] = i;
+        }
+        return bases[i] + symbol->offset;
+    }
+    snprintf(linker->error, LINKER_ERROR_SIZE, "Undefined label: %s", name);
+    return -1;
+}
+
+int lmsm_link(lmsm_linker *linker, asm_compilation_result *job, char **libraries, int library_count, int *code) {
+    int module_count = library_count + 1;
+    lmsm_module job_module = {0};
+    lmsm_module_from_result(&job_module, job);
+
+    lmsm_arena arena = {0};
+    lmsm_module **modules = lmsm_arena_alloc(&arena, sizeof(lmsm_module *) * module_count);
+    int *bases = lmsm_arena_alloc(&arena, sizeof(int) * module_count);
+    int **targets = lmsm_arena_alloc(&arena, sizeof(int *) * module_count);
+    int *order = lmsm_arena_alloc(&arena, sizeof(int) * module_count);
+    modules[0] = &job_module;
+    for (int i = 0; i < library_count; ++i) {
+        modules[i + 1] = lmsm_linker_library(linker, libraries[i]);
+        if (modules[i + 1] == NULL) {
+            lmsm_arena_free(&arena);
+            return -1;
+        }
+    }
+    for (int i = 0; i < module_count; ++i) {
+        bases[i] = -1;
+    }
+
+    // lay out every module reachable from the job, resolving imports as they are found
+    int included = 1;
+    int next_base = job_module.length;
+    bases[0] = 0;
+    order[0] = 0;
+    int linked = 1;
+    for (int i = 0; i < included && linked; ++i) {
+        lmsm_module *module = modules[order[i]];
+        targets[order[i]] = lmsm_arena_alloc(&arena, sizeof(int) * (module->imports.count + 1));
+        for (int j = 0; j < module->imports.count && linked; ++j) {
+            asm_symbol *import = &module->imports.symbols[j];
+            targets[order[i]][import->offset] = lmsm_link_resolve(linker, modules, module_count, bases, order,
+                                                                  &included, &next_base, import->name);
+            linked = targets[order[i]][import->offset] != -1;
+        }
+    }
+    if (linked && next_base > linker->code_size) {
+        snprintf(linker->error, LINKER_ERROR_SIZE, "%s", ASM_ERROR_PROGRAM_TOO_LARGE);
+        linked = 0;
+    }
+
+    if (linked) {
+        int radix = linker->address_radix;
+        memset(code, 0, sizeof(int) * linker->code_size);
+        for (int i = 0; i < included; ++i) {
+            lmsm_module *module = modules[order[i]];
+            int base = bases[order[i]];
+            memcpy(code + base, module->code, sizeof(int) * module->length);
+            for (int j = 0; j < module->relocation_count; ++j) {
+                asm_relocation *relocation = &module->relocations[j];
+                int word = code[base + relocation->slot];
+                int target = relocation->import == -1 ? base + word % radix : targets[order[i]][relocation->import];
+                code[base + relocation->slot] = word - word % radix + target;
+            }
+        }
+    }
+    lmsm_arena_free(&arena);
+    return linked ? next_base : -1;
+}
+
+//======================================================
+// Main API
+//======================================================
+
+lmsm_linker *lmsm_linker_create(int code_size, int address_radix) {
+    lmsm_linker *linker = calloc(1, sizeof(lmsm_linker));
+    linker->code_size = code_size;
+    linker->address_radix = address_radix;
+    return linker;
+}
+
+void lmsm_linker_delete(lmsm_linker *linker) {
+    while (linker->libraries != NULL) {
+        lmsm_module *next = linker->libraries->next;
+        lmsm_module_delete(linker->libraries);
+        linker->libraries = next;
+    }
+    free(linker);
+}
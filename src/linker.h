@@ -0,0 +1,69 @@
+#ifndef LMSM_LINKER_H
+#define LMSM_LINKER_H
+
+#include <time.h>
+#include "arena.h"
+#include "assembler.h"
+#include "object.h"
+
+#define LINKER_ERROR_SIZE 200
+
+//===================================================================
+//  A relocatable module, either assembled in this process or mapped
+//  from the .lmo beside its source
+//
+//  Every label a module defines is exported. References resolve to
+//  the module's own labels first, imports to the first module that
+//  exports the name: the job, then the libraries in the order given.
+//===================================================================
+
+typedef struct lmsm_module {
+    char *path;                      // the source, NULL for a job
+    struct timespec modified;        // of the source when the module was built
+    lmsm_object *object;             // the mapped .lmo, or
+    asm_compilation_result *result;  // the assembled module
+    int *code;
+    int length;
+    asm_symbol_table exports;
+    asm_symbol_table imports;        // the offset of each is its import index
+    asm_relocation *relocations;
+    int relocation_count;
+    lmsm_arena arena;                // the tables and path of a cached module
+    struct lmsm_module *next;
+} lmsm_module;
+
+//===================================================================
+//  Links jobs against a cache of library modules for one layout
+//===================================================================
+
+typedef struct lmsm_linker {
+    int code_size;
+    int address_radix;
+    lmsm_module *libraries;          // every library used so far, most recent first
+    char error[LINKER_ERROR_SIZE];   // why the last call failed
+} lmsm_linker;
+
+//=====================================================
+// API
+//=====================================================
+
+lmsm_linker *lmsm_linker_create(int code_size, int address_radix);
+
+void lmsm_linker_delete(lmsm_linker *linker);
+
+// the library module for an assembly or .firth source, reusing the cached module while the source is
+// unchanged and the .lmo written beside it while that is newer, otherwise assembling it (and writing the .lmo),
+// returns NULL with linker->error set on failure
+lmsm_module *lmsm_linker_library(lmsm_linker *linker, char *path);
+
+// the object a library source is cached in, <path>.lmo, allocated with malloc
+char *lmsm_linker_object_path(char *path);
+
+// assembles a job for linking, returns NULL with linker->error set on failure
+asm_compilation_result *lmsm_linker_assemble(lmsm_linker *linker, char *src, char *name);
+
+// lays out the job at slot 0 followed by the libraries it needs (directly or through another library), and writes
+// the patched image to code[code_size], returns the slots used or -1 with linker->error set
+int lmsm_link(lmsm_linker *linker, asm_compilation_result *job, char **libraries, int library_count, int *code);
+
+#endif //LMSM_LINKER_H
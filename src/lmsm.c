@@ -1,4 +1,6 @@
 #include "lmsm.h"
+#include "trace.h"
+#include "history.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,12 +12,45 @@
 //  Utilities
 //======================================================
 
-void lmsm_cap_value(int * val){
+void lmsm_cap_value(int * val, int limit){
    //TODO - implement capping the value pointed to by this pointer between 999 and -999
-   if(*val > 999)
-       *val = 999;
-   else if (*val < -999)
-       *val = -999;
+   if(*val > limit)
+       *val = limit;
+   else if (*val < -limit)
+       *val = -limit;
+}
+
+// the largest value a cell holds, 999 in the classic layout and 99999 in wide mode
+int lmsm_value_limit(lmsm *our_little_machine) {
+    return our_little_machine->address_radix * 10 - 1;
+}
+
+int lmsm_instruction(lmsm *our_little_machine, int opcode, int operand) {
+    return opcode * our_little_machine->address_radix + operand;
+}
+
+int lmsm_bitmap_test(unsigned char *bitmap, int slot) {
+    return 0 <= slot && slot < MAX_MEMORY_SIZE && (bitmap[slot / 8] & (1 << (slot % 8)));
+}
+
+int lmsm_bitmap_set(unsigned char *bitmap, int slot, int on) {
+    int was_on = lmsm_bitmap_test(bitmap, slot);
+    if (on) {
+        bitmap[slot / 8] |= (unsigned char) (1 << (slot % 8));
+    } else {
+        bitmap[slot / 8] &= (unsigned char) ~(1 << (slot % 8));
+    }
+    return on - was_on;
+}
+
+void lmsm_write_memory(lmsm *our_little_machine, int location, int value) {
+    if (our_little_machine->watchpoint_count && lmsm_bitmap_test(our_little_machine->watchpoints, location)) {
+        our_little_machine->watch_hit = location;
+    }
+    if (our_little_machine->history && our_little_machine->memory[location] != value) {
+        lmsm_history_note_write(our_little_machine->history, location, our_little_machine->memory[location]);
+    }
+    our_little_machine->memory[location] = value;
 }
 
 int lmsm_has_two_values_on_stack(lmsm *our_little_machine) {
@@ -30,7 +65,7 @@ int lmsm_has_two_values_on_stack(lmsm *our_little_machine) {
 //  Instruction Implementation
 //======================================================
 void lmsm_i_pop(lmsm *our_little_machine) {
-    if (our_little_machine->stack_pointer <= TOP_OF_MEMORY) {
+    if (our_little_machine->stack_pointer < our_little_machine->memory_size) {
         our_little_machine->accumulator = our_little_machine->memory[our_little_machine->stack_pointer];
         our_little_machine->stack_pointer++;
     } else {
@@ -45,13 +80,21 @@ void lmsm_i_jal(lmsm *our_little_machine) {
 
     lmsm_i_pop(our_little_machine);
 
+    // the return address stack grows up towards the value stack
+    if (our_little_machine->return_address_pointer + 1 >= our_little_machine->stack_pointer) {
+        our_little_machine->accumulator = temp;
+        our_little_machine->error_code = ERROR_BAD_STACK;
+        our_little_machine->status = STATUS_HALTED;
+        return;
+    }
+
     int newProgramCount = our_little_machine->accumulator;
 
     int oldCount = our_little_machine->program_counter;
     our_little_machine->program_counter = newProgramCount;
 
     our_little_machine->return_address_pointer++;
-    our_little_machine->memory[our_little_machine->return_address_pointer]= oldCount;
+    lmsm_write_memory(our_little_machine, our_little_machine->return_address_pointer, oldCount);
 
 
     our_little_machine->accumulator= temp;
@@ -59,13 +102,25 @@ void lmsm_i_jal(lmsm *our_little_machine) {
 }
 
 void lmsm_i_ret(lmsm *our_little_machine) {
+    // the return address stack is empty at the last code slot, where it starts
+    if (our_little_machine->return_address_pointer < our_little_machine->code_size) {
+        our_little_machine->error_code = ERROR_BAD_STACK;
+        our_little_machine->status = STATUS_HALTED;
+        return;
+    }
     our_little_machine->program_counter = our_little_machine->memory[our_little_machine->return_address_pointer--];
 
 }
 
 void lmsm_i_push(lmsm *our_little_machine) {
+    // the value stack grows down towards the return address stack
+    if (our_little_machine->stack_pointer - 1 <= our_little_machine->return_address_pointer) {
+        our_little_machine->error_code = ERROR_BAD_STACK;
+        our_little_machine->status = STATUS_HALTED;
+        return;
+    }
     our_little_machine->stack_pointer--;
-    our_little_machine->memory[our_little_machine->stack_pointer] = our_little_machine->accumulator;
+    lmsm_write_memory(our_little_machine, our_little_machine->stack_pointer, our_little_machine->accumulator);
 }
 
 
@@ -110,8 +165,8 @@ void lmsm_i_sadd(lmsm *our_little_machine) {
 
     int sum = first + second;
 
-    if (sum >= 999){
-        sum = 999;
+    if (sum >= lmsm_value_limit(our_little_machine)){
+        sum = lmsm_value_limit(our_little_machine);
     }
     our_little_machine->accumulator = sum;
     lmsm_i_push(our_little_machine);
@@ -130,8 +185,8 @@ void lmsm_i_ssub(lmsm *our_little_machine) {
 
     int difference = second- first;
 
-    if (difference <= -999){
-        difference = -999;
+    if (difference <= -lmsm_value_limit(our_little_machine)){
+        difference = -lmsm_value_limit(our_little_machine);
     }
     our_little_machine->accumulator = difference;
     lmsm_i_push(our_little_machine);
@@ -192,8 +247,8 @@ void lmsm_i_smul(lmsm *our_little_machine) {
 
     int product = first * second;
 
-    if (product >= 999){
-        product = 999;
+    if (product >= lmsm_value_limit(our_little_machine)){
+        product = lmsm_value_limit(our_little_machine);
     }
     our_little_machine->accumulator = product;
     lmsm_i_push(our_little_machine);
@@ -212,8 +267,8 @@ void lmsm_i_sdiv(lmsm *our_little_machine) {
 
     int quotient = second / first;
 
-    if (quotient >= 999){
-        quotient = 999;
+    if (quotient >= lmsm_value_limit(our_little_machine)){
+        quotient = lmsm_value_limit(our_little_machine);
     }
     our_little_machine->accumulator = quotient;
     lmsm_i_push(our_little_machine);
@@ -223,17 +278,52 @@ void lmsm_i_sdiv(lmsm *our_little_machine) {
 
 void lmsm_i_out(lmsm *our_little_machine) {
     // TODO, append the current accumulator to the output_buffer in the LMSM
-    char accumulator_str[5];
-    snprintf(accumulator_str, sizeof(accumulator_str), "%d ", our_little_machine->accumulator);
+    char accumulator_str[13];
+    int length = snprintf(accumulator_str, sizeof(accumulator_str), "%d ", our_little_machine->accumulator);
 
-    strcat(our_little_machine->output_buffer, accumulator_str);
+    if (our_little_machine->output_length + length >= OUTPUT_BUFFER_SIZE) {
+        our_little_machine->error_code = ERROR_OUTPUT_EXHAUSTED;
+        our_little_machine->status = STATUS_HALTED;
+        return;
+    }
+    // append at the tracked end rather than rescanning the buffer with strcat
+    memcpy(our_little_machine->output_buffer + our_little_machine->output_length, accumulator_str, length + 1);
+    our_little_machine->output_length += length;
 }
 
 void lmsm_i_inp(lmsm *our_little_machine) {
     // TODO read a value from the command line and store it as an int in the accumulator
+    if (our_little_machine->input_position == our_little_machine->input_length) {
+        // nothing queued, read from the command line and keep it so checkpoints capture it
         int inpInt;
-        scanf("%d", &inpInt);
-        our_little_machine->accumulator = inpInt;
+        if (scanf("%d", &inpInt) != 1 || !lmsm_queue_input(our_little_machine, inpInt)) {
+            // the input has ended, or a value the queue cannot keep would be missing from checkpoints and
+            // reverse steps
+            our_little_machine->error_code = ERROR_INPUT_EXHAUSTED;
+            our_little_machine->status = STATUS_HALTED;
+            return;
+        }
+    }
+    our_little_machine->accumulator = our_little_machine->input_buffer[our_little_machine->input_position++];
+}
+
+int lmsm_queue_input(lmsm *our_little_machine, int value) {
+    if (our_little_machine->input_length == our_little_machine->input_capacity) {
+        int capacity = our_little_machine->input_capacity ? our_little_machine->input_capacity * 2 : INPUT_BUFFER_SIZE;
+        int *input_buffer = realloc(our_little_machine->input_buffer, sizeof(int) * capacity);
+        if (input_buffer == NULL) {
+            return 0;
+        }
+        our_little_machine->input_buffer = input_buffer;
+        our_little_machine->input_capacity = capacity;
+    }
+    our_little_machine->input_buffer[our_little_machine->input_length++] = value;
+    return 1;
+}
+
+void lmsm_clear_input(lmsm *our_little_machine) {
+    our_little_machine->input_length = 0;
+    our_little_machine->input_position = 0;
 }
 
 void lmsm_i_load(lmsm *our_little_machine, int location) {
@@ -254,7 +344,7 @@ void lmsm_i_load_immediate(lmsm *our_little_machine, int value) {
 }
 
 void lmsm_i_store(lmsm *our_little_machine, int location) {
-    our_little_machine->memory[location]=our_little_machine->accumulator;
+    lmsm_write_memory(our_little_machine, location, our_little_machine->accumulator);
 }
 
 void lmsm_i_halt(lmsm *our_little_machine) {
@@ -280,12 +370,30 @@ void lmsm_step(lmsm *our_little_machine) {
     // TODO : if the machine is not halted, we need to read the instruction in the memory slot
     //        pointed to by the program counter, bump the program counter then execute
     //        the instruction
+    our_little_machine->breakpoint_hit = -1;
     if (our_little_machine->status != STATUS_HALTED) {
+        // checked before the history opens a step, as no step is taken
+        int program_counter = our_little_machine->program_counter;
+        if (program_counter < 0 || program_counter >= our_little_machine->memory_size) {
+            our_little_machine->error_code = ERROR_BAD_ADDRESS;
+            our_little_machine->status = STATUS_HALTED;
+            return;
+        }
+        if (our_little_machine->history) {
+            lmsm_history_begin_step(our_little_machine->history, our_little_machine);
+        }
         int next_instruction = our_little_machine->memory[our_little_machine->program_counter];
         our_little_machine->program_counter++;
         our_little_machine->current_instruction = next_instruction;
         int instruction = our_little_machine->current_instruction;
         lmsm_exec_instruction(our_little_machine, instruction);
+        if (our_little_machine->history) {
+            lmsm_history_end_step(our_little_machine->history, our_little_machine);
+        }
+        if (our_little_machine->trace) {
+            lmsm_trace_record(our_little_machine->trace, program_counter, instruction,
+                              our_little_machine->accumulator, our_little_machine->stack_pointer);
+        }
     }
 }
 
@@ -298,64 +406,74 @@ void lmsm_exec_instruction(lmsm *our_little_machine, int instruction) {
     // TODO - dispatch the rest of the instruction set and implement
     //        the instructions above
 
+    int opcode = instruction / our_little_machine->address_radix;
+    int operand = instruction % our_little_machine->address_radix;
+
     if (instruction == 0) {
         lmsm_i_halt(our_little_machine);
-    } else if (100 <= instruction && instruction <= 199) {
-        lmsm_i_add(our_little_machine, instruction - 100);
-    } else if (200 <=instruction && instruction <= 299) {
-        lmsm_i_sub(our_little_machine,instruction - 200);
-    } else if (300 <=instruction && instruction <= 399) {
-        lmsm_i_store(our_little_machine,instruction - 300);
-    } else if (400 <=instruction && instruction <= 499) {
-        lmsm_i_load_immediate(our_little_machine,instruction - 400);
-    }else if (500 <=instruction && instruction <= 599) {
-        lmsm_i_load(our_little_machine,instruction - 500);
-    } else if (600 <=instruction && instruction <= 699) {
-        lmsm_i_branch_unconditional(our_little_machine,instruction - 600);
-    } else if (700 <=instruction && instruction <= 799) {
-        lmsm_i_branch_if_zero(our_little_machine,instruction - 700);
-    } else if (800 <=instruction && instruction <= 899) {
-        lmsm_i_branch_if_positive(our_little_machine,instruction - 800);
-    } else if (instruction == 901) {
+    } else if (opcode != 4 && 1 <= opcode && opcode <= 5 && operand >= our_little_machine->memory_size) {
+        // LDI takes a value, the others name a slot, which only wide mode can put past the end of memory
+        our_little_machine->error_code = ERROR_BAD_ADDRESS;
+        our_little_machine->status = STATUS_HALTED;
+    } else if (opcode == 1) {
+        lmsm_i_add(our_little_machine, operand);
+    } else if (opcode == 2) {
+        lmsm_i_sub(our_little_machine, operand);
+    } else if (opcode == 3) {
+        lmsm_i_store(our_little_machine, operand);
+    } else if (opcode == 4) {
+        lmsm_i_load_immediate(our_little_machine, operand);
+    } else if (opcode == 5) {
+        lmsm_i_load(our_little_machine, operand);
+    } else if (opcode == 6) {
+        lmsm_i_branch_unconditional(our_little_machine, operand);
+    } else if (opcode == 7) {
+        lmsm_i_branch_if_zero(our_little_machine, operand);
+    } else if (opcode == 8) {
+        lmsm_i_branch_if_positive(our_little_machine, operand);
+    } else if (opcode != 9) {
+        our_little_machine->error_code = ERROR_UNKNOWN_INSTRUCTION;
+        our_little_machine->status = STATUS_HALTED;
+    } else if (operand == 1) {
         lmsm_i_inp(our_little_machine);
-    } else if (instruction == 902) {
+    } else if (operand == 2) {
         lmsm_i_out(our_little_machine);
-    } else if (instruction == 910) {
+    } else if (operand == 10) {
         lmsm_i_jal(our_little_machine);
-    } else if (instruction == 911) {
+    } else if (operand == 11) {
         lmsm_i_ret(our_little_machine);
-    } else if (instruction == 920) {
+    } else if (operand == 20) {
         lmsm_i_push(our_little_machine);
-    } else if (instruction == 921) {
+    } else if (operand == 21) {
         lmsm_i_pop(our_little_machine);
-    } else if (instruction == 922) {
+    } else if (operand == 22) {
         lmsm_i_dup(our_little_machine);
-    } else if (instruction == 923) {
+    } else if (operand == 23) {
         lmsm_i_drop(our_little_machine);
-    } else if (instruction == 924) {
+    } else if (operand == 24) {
         lmsm_i_swap(our_little_machine);
-    } else if (instruction == 930) {
+    } else if (operand == 30) {
         lmsm_i_sadd(our_little_machine);
-    } else if (instruction == 931) {
+    } else if (operand == 31) {
         lmsm_i_ssub(our_little_machine);
-    } else if (instruction == 932) {
+    } else if (operand == 32) {
         lmsm_i_smul(our_little_machine);
-    } else if (instruction == 933) {
+    } else if (operand == 33) {
         lmsm_i_sdiv(our_little_machine);
-    } else if (instruction == 934) {
+    } else if (operand == 34) {
         lmsm_i_smax(our_little_machine);
-    } else if (instruction == 935) {
+    } else if (operand == 35) {
         lmsm_i_smin(our_little_machine);
     }
     else {
         our_little_machine->error_code = ERROR_UNKNOWN_INSTRUCTION;
         our_little_machine->status = STATUS_HALTED;
     }
-    lmsm_cap_value(&our_little_machine->accumulator);
+    lmsm_cap_value(&our_little_machine->accumulator, lmsm_value_limit(our_little_machine));
 }
 
 void lmsm_load(lmsm *our_little_machine, int *program, int length) {
-    for (int i = 0; i < length; ++i) {
+    for (int i = 0; i < length && i < our_little_machine->memory_size; ++i) {
         our_little_machine->memory[i] = program[i];
     }
 }
@@ -366,10 +484,17 @@ void lmsm_init(lmsm *the_machine) {
     the_machine->error_code = ERROR_NONE;
     the_machine->program_counter = 0;
     the_machine->current_instruction = 0;
-    the_machine->stack_pointer = TOP_OF_MEMORY + 1;
-    the_machine->return_address_pointer = TOP_OF_MEMORY - 100;
-    memset(the_machine->output_buffer, 0, sizeof(char) * 1000);
-    memset(the_machine->memory, 0, sizeof(int) * TOP_OF_MEMORY + 1);
+    the_machine->watch_hit = -1;
+    the_machine->breakpoint_hit = -1;
+    the_machine->output_length = 0;
+    the_machine->input_position = 0;
+    if (the_machine->history) {
+        lmsm_history_clear(the_machine->history);
+    }
+    the_machine->stack_pointer = the_machine->memory_size;
+    the_machine->return_address_pointer = the_machine->code_size - 1;
+    memset(the_machine->output_buffer, 0, sizeof(char) * OUTPUT_BUFFER_SIZE);
+    memset(the_machine->memory, 0, sizeof(int) * the_machine->memory_size);
 }
 
 void lmsm_reset(lmsm *our_little_machine) {
@@ -383,12 +508,72 @@ void lmsm_run(lmsm *our_little_machine) {
     }
 }
 
+stop_reason lmsm_run_debug(lmsm *our_little_machine) {
+    our_little_machine->status = STATUS_RUNNING;
+    while (our_little_machine->status != STATUS_HALTED) {
+        // when resuming from a breakpoint, execute the instruction under it first, but stop at any other,
+        // including one a step has since reached
+        if (our_little_machine->breakpoint_hit != our_little_machine->program_counter &&
+            lmsm_bitmap_test(our_little_machine->breakpoints, our_little_machine->program_counter)) {
+            our_little_machine->watch_hit = -1;
+            our_little_machine->breakpoint_hit = our_little_machine->program_counter;
+            return STOP_BREAKPOINT;
+        }
+        our_little_machine->watch_hit = -1;
+        lmsm_step(our_little_machine);
+        if (our_little_machine->watch_hit != -1) {
+            return STOP_WATCHPOINT;
+        }
+    }
+    return STOP_HALTED;
+}
+
+void lmsm_set_breakpoint(lmsm *our_little_machine, int slot, int on) {
+    if (0 <= slot && slot < our_little_machine->memory_size) {
+        our_little_machine->breakpoint_count += lmsm_bitmap_set(our_little_machine->breakpoints, slot, on);
+    }
+}
+
+void lmsm_set_watchpoint(lmsm *our_little_machine, int slot, int on) {
+    if (0 <= slot && slot < our_little_machine->memory_size) {
+        our_little_machine->watchpoint_count += lmsm_bitmap_set(our_little_machine->watchpoints, slot, on);
+    }
+}
+
+int lmsm_configure(lmsm *our_little_machine, int memory_size, int address_radix) {
+    if (address_radix == ADDRESS_RADIX) {
+        if (memory_size != TOP_OF_MEMORY + 1) {
+            return 0;
+        }
+    } else if (address_radix != WIDE_ADDRESS_RADIX || memory_size < 2 * CODE_SIZE || memory_size > MAX_MEMORY_SIZE ||
+               memory_size % 2 != 0) {
+        return 0;
+    }
+    our_little_machine->memory = realloc(our_little_machine->memory, sizeof(int) * memory_size);
+    our_little_machine->memory_size = memory_size;
+    our_little_machine->code_size = memory_size / 2;
+    our_little_machine->address_radix = address_radix;
+    lmsm_init(our_little_machine);
+    return 1;
+}
+
 lmsm *lmsm_create() {
-    lmsm *the_machine = malloc(sizeof(lmsm));
-    lmsm_init(the_machine);
+    lmsm *the_machine = calloc(1, sizeof(lmsm));
+    lmsm_configure(the_machine, TOP_OF_MEMORY + 1, ADDRESS_RADIX);
+    return the_machine;
+}
+
+lmsm *lmsm_create_wide(int memory_size) {
+    lmsm *the_machine = calloc(1, sizeof(lmsm));
+    if (!lmsm_configure(the_machine, memory_size, WIDE_ADDRESS_RADIX)) {
+        free(the_machine);
+        return NULL;
+    }
     return the_machine;
 }
 
 void lmsm_delete(lmsm *the_machine) {
+    free(the_machine->memory);
+    free(the_machine->input_buffer);
     free(the_machine);
 }
\ No newline at end of file
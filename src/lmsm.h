@@ -16,10 +16,24 @@ typedef enum error_code {
     ERROR_BAD_STACK,
     ERROR_OUTPUT_EXHAUSTED,
     ERROR_UNKNOWN_INSTRUCTION,
+    ERROR_BAD_ADDRESS,
+    ERROR_INPUT_EXHAUSTED,
 } error_code;
 
-#define TOP_OF_MEMORY 199
+typedef enum stop_reason {
+    STOP_HALTED,
+    STOP_BREAKPOINT,
+    STOP_WATCHPOINT,
+} stop_reason;
+
+#define TOP_OF_MEMORY 199           // the top of memory in the classic layout
+#define CODE_SIZE 100               // slots below the return address stack in the classic layout
+#define ADDRESS_RADIX 100           // instruction words are opcode * radix + address
+#define WIDE_ADDRESS_RADIX 10000    // wide mode uses 4 digit addresses, e.g. 61234 is BRA 1234
+#define MAX_MEMORY_SIZE WIDE_ADDRESS_RADIX
 #define OUTPUT_BUFFER_SIZE 4000
+#define INPUT_BUFFER_SIZE 1000     // values the input queue first makes room for, it grows as needed
+#define MEMORY_BITMAP_SIZE (MAX_MEMORY_SIZE / 8)
 
 //===================================================================
 //  Represents the core computational infrastructure of the
@@ -34,8 +48,24 @@ typedef struct lmsm {
     int accumulator;
     int stack_pointer;
     int return_address_pointer;
-    int memory[TOP_OF_MEMORY + 1];
+    int *memory;
+    int memory_size;           // slots of memory, the value stack grows down from the top
+    int code_size;             // slots below the return address stack, which grows up from here
+    int address_radix;         // ADDRESS_RADIX, or WIDE_ADDRESS_RADIX in wide mode
     char output_buffer[OUTPUT_BUFFER_SIZE];
+    int output_length;         // chars used in the output buffer
+    int *input_buffer;         // values for INP, queued up front or read from the command line
+    int input_length;
+    int input_capacity;
+    int input_position;        // the next value INP takes, rewound (but kept) on reset
+    struct lmsm_trace *trace;  // optional execution trace, survives resets
+    unsigned char breakpoints[MEMORY_BITMAP_SIZE];  // slots lmsm_run_debug stops before executing
+    unsigned char watchpoints[MEMORY_BITMAP_SIZE];  // slots lmsm_run_debug stops after writing
+    int breakpoint_count;
+    int watchpoint_count;      // 0 skips the watch check on every write
+    int watch_hit;             // the watched slot written by the last step, -1 if none
+    int breakpoint_hit;        // the breakpoint lmsm_run_debug stopped before, -1 once the machine moves on
+    struct lmsm_history *history;  // optional undo log for reverse stepping
 } lmsm;
 
 //=====================================================
@@ -45,6 +75,16 @@ typedef struct lmsm {
 // create a new little man stack machine
 lmsm * lmsm_create();
 
+// create a machine with 4 digit addresses and an even memory_size from 200 to MAX_MEMORY_SIZE,
+// the lower half holds code, returns NULL for a bad size
+lmsm * lmsm_create_wide(int memory_size);
+
+// changes the memory layout and resets the machine, returns 0 (leaving it alone) for a bad layout
+int lmsm_configure(lmsm *our_little_machine, int memory_size, int address_radix);
+
+// the instruction word for an opcode and operand in the machine's encoding, e.g. (9, 1) is INP
+int lmsm_instruction(lmsm *our_little_machine, int opcode, int operand);
+
 // deletes the machine
 void lmsm_delete(lmsm *the_machine);
 
@@ -54,6 +94,13 @@ void lmsm_load(lmsm *our_little_machine, int program[], int length);
 // run the little man machine
 void lmsm_run(lmsm *our_little_machine);
 
+// run the little man machine until it halts, reaches a breakpoint or writes a watched slot
+stop_reason lmsm_run_debug(lmsm *our_little_machine);
+
+// adds (on = 1) or removes (on = 0) a breakpoint or watchpoint, breakpoints survive resets
+void lmsm_set_breakpoint(lmsm *our_little_machine, int slot, int on);
+void lmsm_set_watchpoint(lmsm *our_little_machine, int slot, int on);
+
 // step on asm_instruction on the little man machine
 void lmsm_step(lmsm *our_little_machine);
 
@@ -62,4 +109,10 @@ void lmsm_exec_instruction(lmsm *our_little_machine, int instruction);
 
 void lmsm_reset(lmsm *our_little_machine);
 
+// queues a value for a later INP, growing the queue, returns 0 if there is no memory to keep it
+int lmsm_queue_input(lmsm *our_little_machine, int value);
+
+// empties the input queue, for a new program rather than a rerun of this one
+void lmsm_clear_input(lmsm *our_little_machine);
+
 #endif //LMSM_LMSM_H
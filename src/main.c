@@ -1,13 +1,131 @@
 #include "assembler.h"
 #include "lmsm.h"
 #include "repl.h"
+#include "trace.h"
+#include "checkpoint.h"
+#include "batch.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+// a classic machine, or a wide one when memory_size is not 0
+lmsm *main_create_machine(int memory_size) {
+    if (memory_size == 0) {
+        return lmsm_create();
+    }
+    lmsm *our_little_machine = lmsm_create_wide(memory_size);
+    if (our_little_machine == NULL) {
+        printf("Bad memory size: %d (an even number from %d to %d)\n", memory_size, 2 * CODE_SIZE, MAX_MEMORY_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    return our_little_machine;
+}
 
 int main(int argc, char *argv[]) {
+    int memory_size = 0;
+    if (argc >= 3 && strcmp(argv[1], "--wide") == 0) {
+        // --wide <memory size> ahead of any other arguments selects 4 digit addresses
+        memory_size = atoi(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--optimize") == 0) {
+        // --optimize, after any --wide, runs programs through the peephole optimiser
+        repl_set_optimize(1);
+        argv[1] = argv[0];
+        argv += 1;
+        argc -= 1;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--decode-trace") == 0) {
+        lmsm_trace *trace = lmsm_trace_open(argv[2]);
+        if (trace == NULL) {
+            printf("Not a trace file: '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        int intact = lmsm_trace_decode(trace, stdout);
+        lmsm_trace_delete(trace);
+        if (!intact) {
+            printf("Corrupt trace file: '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--analyze") == 0) {
+        return repl_analyze_file(main_create_machine(memory_size), argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "--emit-object") == 0) {
+        return repl_emit_object(main_create_machine(memory_size), argv[2], argv[3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--link") == 0) {
+        // --link <program> [<library> ...] runs the program linked against the libraries
+        lmsm *our_little_machine = main_create_machine(memory_size);
+        if (!repl_link_files(our_little_machine, argv[2], argv + 3, argc - 3)) {
+            return EXIT_FAILURE;
+        }
+        lmsm_run(our_little_machine);
+        printf("Output: %s\n", our_little_machine->output_buffer);
+        return EXIT_SUCCESS;
+    }
+
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--batch") == 0) {
+        // --batch <directory or manifest> [<threads>] assembles every source into its .lmo
+        lmsm *our_little_machine = main_create_machine(memory_size);
+        lmsm_batch *batch = lmsm_batch_create(our_little_machine->code_size, our_little_machine->address_radix);
+        lmsm_delete(our_little_machine);
+        if (!lmsm_batch_add(batch, argv[2])) {
+            printf("Not a directory or manifest: '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        lmsm_batch_run(batch, argc == 4 ? atoi(argv[3]) : 0);
+        int failed = lmsm_batch_print_summary(batch, stdout);
+        lmsm_batch_delete(batch);
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (argc == 5 && strcmp(argv[1], "--checkpoint") == 0) {
+        // --checkpoint <steps> <checkpoint file> <program>
+        if (atol(argv[2]) <= 0) {
+            printf("Bad checkpoint steps: '%s' (a positive number)\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        lmsm *our_little_machine = main_create_machine(memory_size);
+        if (!repl_load_file(our_little_machine, argv[4])) {
+            return EXIT_FAILURE;
+        }
+        lmsm_run_with_checkpoints(our_little_machine, atol(argv[2]), argv[3]);
+        printf("Output: %s\n", our_little_machine->output_buffer);
+        return EXIT_SUCCESS;
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--resume") == 0) {
+        // --resume <checkpoint file> [<steps>]
+        if (argc == 4 && atol(argv[3]) <= 0) {
+            printf("Bad checkpoint steps: '%s' (a positive number)\n", argv[3]);
+            return EXIT_FAILURE;
+        }
+        lmsm *our_little_machine = lmsm_create();
+        if (!lmsm_checkpoint_restore(our_little_machine, argv[2])) {
+            printf("Not a checkpoint: '%s'\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        if (our_little_machine->status == STATUS_HALTED) {
+            // the job had already finished when the checkpoint was taken
+        } else if (argc == 4) {
+            lmsm_run_with_checkpoints(our_little_machine, atol(argv[3]), argv[2]);
+        } else {
+            lmsm_run(our_little_machine);
+        }
+        printf("Output: %s\n", our_little_machine->output_buffer);
+        return EXIT_SUCCESS;
+    }
+
     printf("Little Man Stack Machine...\n\n");
 
-    lmsm * our_little_machine = lmsm_create();
+    lmsm * our_little_machine = main_create_machine(memory_size);
     if (argc == 2) {
         int result = repl_load_file(our_little_machine, argv[1]);
         if (result) {
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "object.h"
+
+//======================================================
+// Writing
+//======================================================
+
+int lmsm_object_code_length(asm_compilation_result *result) {
+    int length = 0;
+    asm_instruction *current = result->root;
+    while (current != NULL) {
+        if (current->offset + current->slots > length) {
+            length = current->offset + current->slots;
+        }
+        current = current->next;
+    }
+    return length < result->code_size ? length : result->code_size;
+}
+
+unsigned long long lmsm_object_hash(const char *data, size_t length) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+int lmsm_object_write(asm_compilation_result *result, int include_debug_map, unsigned long long source_hash, char *path) {
+    lmsm_object_header header = {0};
+    header.magic = OBJECT_MAGIC;
+    header.version = OBJECT_VERSION;
+    header.flags = (include_debug_map ? OBJECT_HAS_DEBUG_MAP : 0) | (result->relocatable ? OBJECT_RELOCATABLE : 0);
+    header.code_length = lmsm_object_code_length(result);
+    header.entry_point = 0;
+    header.address_radix = result->address_radix;
+    header.memory_size = result->address_radix == ADDRESS_RADIX ? TOP_OF_MEMORY + 1 : result->code_size * 2;
+    header.source_hash[0] = (unsigned int) source_hash;
+    header.source_hash[1] = (unsigned int) (source_hash >> 32);
+
+    asm_symbol_table *table = &result->symbols;
+    asm_symbol_table *imports = &result->imports;
+    header.symbol_count = table->count;
+    header.relocation_count = result->relocation_count;
+    header.import_count = imports->count;
+    for (int i = 0; i < table->count; ++i) {
+        header.string_table_size += strlen(table->symbols[i].name) + 1;
+    }
+    for (int i = 0; i < imports->count; ++i) {
+        header.string_table_size += strlen(imports->symbols[i].name) + 1;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return 0;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(result->code, sizeof(int), header.code_length, file);
+
+    unsigned int name = 0;
+    for (int i = 0; i < table->count; ++i) {
+        lmsm_object_symbol symbol = {name, table->symbols[i].offset};
+        fwrite(&symbol, sizeof(symbol), 1, file);
+        name += strlen(table->symbols[i].name) + 1;
+    }
+    fwrite(result->relocations, sizeof(asm_relocation), header.relocation_count, file);
+    for (int i = 0; i < imports->count; ++i) {
+        // the import table is in index order, which is the order the imports were added
+        fwrite(&name, sizeof(name), 1, file);
+        name += strlen(imports->symbols[i].name) + 1;
+    }
+    if (include_debug_map) {
+        fwrite(result->source_map, sizeof(asm_source_location), header.code_length, file);
+    }
+    for (int i = 0; i < table->count; ++i) {
+        fwrite(table->symbols[i].name, 1, strlen(table->symbols[i].name) + 1, file);
+    }
+    for (int i = 0; i < imports->count; ++i) {
+        fwrite(imports->symbols[i].name, 1, strlen(imports->symbols[i].name) + 1, file);
+    }
+    return fclose(file) == 0;
+}
+
+//======================================================
+// Loading
+//======================================================
+
+lmsm_object *lmsm_object_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(lmsm_object_header)) {
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    lmsm_object_header *header = mapping;
+    size_t code_size = (size_t) header->code_length * sizeof(int);
+    size_t symbols_size = (size_t) header->symbol_count * sizeof(lmsm_object_symbol);
+    size_t relocations_size = (size_t) header->relocation_count * sizeof(asm_relocation);
+    size_t imports_size = (size_t) header->import_count * sizeof(unsigned int);
+    size_t debug_size = (header->flags & OBJECT_HAS_DEBUG_MAP) ? header->code_length * sizeof(asm_source_location) : 0;
+    if (header->magic != OBJECT_MAGIC || header->version != OBJECT_VERSION ||
+        header->memory_size > MAX_MEMORY_SIZE || header->code_length > header->memory_size / 2 ||
+        header->relocation_count > header->code_length ||
+        sizeof(lmsm_object_header) + code_size + symbols_size + relocations_size + imports_size + debug_size +
+        header->string_table_size > (size_t) info.st_size) {
+        munmap(mapping, info.st_size);
+        return NULL;
+    }
+
+    // the sections are used in place, nothing is parsed or copied
+    lmsm_object *object = calloc(1, sizeof(lmsm_object));
+    object->mapping = mapping;
+    object->size = info.st_size;
+    object->header = header;
+    object->code = (int *) (header + 1);
+    object->symbols = (lmsm_object_symbol *) (object->code + header->code_length);
+    object->relocations = (asm_relocation *) (object->symbols + header->symbol_count);
+    object->imports = (unsigned int *) (object->relocations + header->relocation_count);
+    object->debug_map = debug_size ? (asm_source_location *) (object->imports + header->import_count) : NULL;
+    object->strings = (char *) (object->imports + header->import_count) + debug_size;
+    return object;
+}
+
+unsigned long long lmsm_object_source_hash(lmsm_object *object) {
+    return (unsigned long long) object->header->source_hash[1] << 32 | object->header->source_hash[0];
+}
+
+void lmsm_object_close(lmsm_object *object) {
+    munmap(object->mapping, object->size);
+    free(object);
+}
+
+int lmsm_object_load(lmsm_object *object, lmsm *our_little_machine) {
+    if (object->header->import_count > 0) {
+        return 0;
+    }
+    if (!lmsm_configure(our_little_machine, (int) object->header->memory_size, (int) object->header->address_radix)) {
+        return 0;
+    }
+    lmsm_clear_input(our_little_machine);
+    lmsm_load(our_little_machine, object->code, (int) object->header->code_length);
+    our_little_machine->program_counter = object->header->entry_point;
+    return 1;
+}
+
+asm_compilation_result *lmsm_object_result(lmsm_object *object) {
+    lmsm_object_header *header = object->header;
+    int length = (int) header->code_length;
+    int radix = (int) header->address_radix;
+    asm_compilation_result *result = asm_make_sized_compilation_result((int) header->memory_size / 2, radix);
+    memcpy(result->code, object->code, sizeof(int) * length);
+    if (object->debug_map) {
+        memcpy(result->source_map, object->debug_map, sizeof(asm_source_location) * length);
+    }
+
+    // the label of each slot, the string table is only trusted as far as its size
+    char **labels = calloc(length, sizeof(char *));
+    for (unsigned int i = 0; i < header->symbol_count; ++i) {
+        lmsm_object_symbol *symbol = &object->symbols[i];
+        if (symbol->name >= header->string_table_size) {
+            continue;
+        }
+        char *name = object->strings + symbol->name;
+        char *label = lmsm_arena_strndup(&result->arena, name, strnlen(name, header->string_table_size - symbol->name));
+        if (asm_define_label(result, label, symbol->offset) && 0 <= symbol->offset && symbol->offset < length) {
+            labels[symbol->offset] = label;
+        }
+    }
+
+    // CALL assembles to LDI <label>, SPUSH, JAL, and a BRA to a label can be a Firth tail call
+    asm_instruction *last = NULL;
+    for (int slot = 0; slot < length; ++slot) {
+        int opcode = result->code[slot] / radix;
+        int operand = result->code[slot] % radix;
+        char *label = 0 <= operand && operand < length ? labels[operand] : NULL;
+        char *instruction = NULL;
+        if (opcode == 4 && slot + 2 < length &&
+            result->code[slot + 1] == 9 * radix + 20 && result->code[slot + 2] == 9 * radix + 10) {
+            instruction = "CALL";
+        } else if (opcode == 6) {
+            instruction = "BRA";
+        }
+        if (label && instruction) {
+            last = asm_add_instruction(result, last, instruction, NULL, label, (int) strlen(label),
+                                       result->source_map[slot].line, result->source_map[slot].column);
+            last->offset = slot;
+        }
+    }
+    free(labels);
+    return result;
+}
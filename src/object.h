@@ -0,0 +1,94 @@
+#ifndef LMSM_OBJECT_H
+#define LMSM_OBJECT_H
+
+#include <stddef.h>
+#include "lmsm.h"
+#include "assembler.h"
+
+#define OBJECT_MAGIC 0x4F534D4C   // "LMSO"
+#define OBJECT_VERSION 4
+#define OBJECT_HAS_DEBUG_MAP 1
+#define OBJECT_RELOCATABLE 2
+
+//===================================================================
+//  On disk layout, every section is an array of 4 byte fields:
+//
+//    lmsm_object_header
+//    int code[code_length]
+//    lmsm_object_symbol symbols[symbol_count]
+//    asm_relocation relocations[relocation_count]
+//    unsigned int imports[import_count]           (offsets of the imported names in the string table)
+//    asm_source_location debug_map[code_length]   (if OBJECT_HAS_DEBUG_MAP)
+//    char strings[string_table_size]              (NUL terminated names)
+//
+//  Only OBJECT_RELOCATABLE objects, written from asm_assemble_module, have relocations and imports.
+//===================================================================
+
+typedef struct lmsm_object_header {
+    unsigned int magic;
+    unsigned short version;
+    unsigned short flags;
+    unsigned int code_length;
+    int entry_point;
+    unsigned int symbol_count;
+    unsigned int string_table_size;
+    unsigned int address_radix;    // ADDRESS_RADIX, or WIDE_ADDRESS_RADIX for a wide machine
+    unsigned int memory_size;      // the memory the program was assembled for
+    unsigned int relocation_count;
+    unsigned int import_count;
+    unsigned int source_hash[2];   // lmsm_object_hash of the source, low word first, 0 if unknown
+} lmsm_object_header;
+
+typedef struct lmsm_object_symbol {
+    unsigned int name;     // offset of the name in the string table
+    int offset;            // the code slot the symbol labels
+} lmsm_object_symbol;
+
+//===================================================================
+//  An object file mapped into memory
+//===================================================================
+
+typedef struct lmsm_object {
+    void *mapping;
+    size_t size;
+    lmsm_object_header *header;
+    int *code;
+    lmsm_object_symbol *symbols;
+    asm_relocation *relocations;
+    unsigned int *imports;
+    asm_source_location *debug_map;   // NULL when the object has no debug map
+    char *strings;
+} lmsm_object;
+
+//=====================================================
+// API
+//=====================================================
+
+// the slots an assembled program uses
+int lmsm_object_code_length(asm_compilation_result *result);
+
+// 64 bit FNV-1a, used to tell whether an object is up to date with its source
+unsigned long long lmsm_object_hash(const char *data, size_t length);
+
+// the source hash recorded in an object
+unsigned long long lmsm_object_source_hash(lmsm_object *object);
+
+// writes an assembled program as an object file, source_hash may be 0 when the source is not known,
+// returns 1 on success
+int lmsm_object_write(asm_compilation_result *result, int include_debug_map, unsigned long long source_hash, char *path);
+
+// maps an object file, returns NULL if it is missing or not a valid object
+lmsm_object *lmsm_object_open(char *path);
+
+void lmsm_object_close(lmsm_object *object);
+
+// lays out the machine's memory for the object, resets it and loads the code image at its entry point,
+// returns 0 if the machine cannot take the layout or the object has imports that need linking
+int lmsm_object_load(lmsm_object *object, lmsm *our_little_machine);
+
+// rebuilds what the debugger keeps about a program from its object: the code, the symbols, the source of each slot
+// when the object has a debug map, and a CALL (or BRA) instruction for each call site, for the profiler to find the
+// functions by. Nothing else of the instructions survives
+asm_compilation_result *lmsm_object_result(lmsm_object *object);
+
+#endif //LMSM_OBJECT_H
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profiler.h"
+
+//======================================================
+// Constructors/Destructors
+//======================================================
+
+int lmsm_profile_add_function(lmsm_profile *profile, char *name, int *entries, int entry) {
+    for (int i = 1; i < profile->function_count; ++i) {
+        if (entries[i] == entry) {
+            return i;
+        }
+    }
+    if (profile->function_count > PROFILE_MAX_FUNCTIONS) {
+        return 0;
+    }
+    entries[profile->function_count] = entry;
+    profile->function_names[profile->function_count] = strdup(name);
+    return profile->function_count++;
+}
+
+lmsm_profile *lmsm_profile_create(asm_compilation_result *assembly, firth_compilation_result *firth, int sample_interval) {
+    lmsm_profile *profile = calloc(1, sizeof(lmsm_profile));
+    profile->sample_interval = sample_interval > 0 ? sample_interval : 1;
+    profile->countdown = 0;
+    profile->root.function = -1;
+    profile->code_size = assembly->code_size;
+    profile->function_of = calloc(profile->code_size, sizeof(int));
+    profile->source_of = calloc(profile->code_size, sizeof(asm_source_location));
+    profile->cycles = calloc(profile->code_size, sizeof(long));
+
+    // function 0 is everything before the first called label
+    int entries[PROFILE_MAX_FUNCTIONS + 1] = {0};
+    profile->function_names[0] = strdup("main");
+    profile->function_count = 1;
+
+    // every CALL target starts a new function, which is exactly what Firth emits for a def, as does a BRA to a
+    // Firth function (a tail call), whose label ends in ()
+    asm_instruction *current = assembly->root;
+    while (current != NULL) {
+        size_t length = current->label_reference ? strlen(current->label_reference) : 0;
+        if (current->label_reference &&
+            (strcmp(current->instruction, "CALL") == 0 ||
+             (strcmp(current->instruction, "BRA") == 0 && length > 2 &&
+              strcmp(current->label_reference + length - 2, "()") == 0))) {
+            int entry = asm_find_label(assembly, current->label_reference);
+            if (entry > 0) {
+                lmsm_profile_add_function(profile, current->label_reference, entries, entry);
+            }
+        }
+        current = current->next;
+    }
+
+    for (int slot = 0; slot < profile->code_size; ++slot) {
+        int owner = 0;
+        for (int i = 1; i < profile->function_count; ++i) {
+            if (entries[i] <= slot && entries[i] > entries[owner]) {
+                owner = i;
+            }
+        }
+        profile->function_of[slot] = owner;
+
+        profile->source_of[slot] = assembly->source_map[slot];
+        int line, column;
+        if (firth && assembly->source_map[slot].line &&
+            firth_source_location(firth, assembly->source_map[slot].line, &line, &column)) {
+            profile->source_of[slot].line = line;
+            profile->source_of[slot].column = column;
+        }
+    }
+    return profile;
+}
+
+void lmsm_profile_delete_frames(lmsm_profile_frame *frame) {
+    lmsm_profile_frame *child = frame->first_child;
+    while (child != NULL) {
+        lmsm_profile_frame *to_delete = child;
+        child = to_delete->next_sibling;
+        lmsm_profile_delete_frames(to_delete);
+        free(to_delete);
+    }
+}
+
+void lmsm_profile_delete(lmsm_profile *profile) {
+    lmsm_profile_delete_frames(&profile->root);
+    for (int i = 0; i < profile->function_count; ++i) {
+        free(profile->function_names[i]);
+    }
+    free(profile->function_of);
+    free(profile->source_of);
+    free(profile->cycles);
+    free(profile);
+}
+
+//======================================================
+// Sampling
+//======================================================
+
+int lmsm_profile_function_at(lmsm_profile *profile, int slot) {
+    if (slot < 0 || slot >= profile->code_size) {
+        return 0;
+    }
+    return profile->function_of[slot];
+}
+
+lmsm_profile_frame *lmsm_profile_child(lmsm_profile_frame *parent, int function) {
+    lmsm_profile_frame *child = parent->first_child;
+    while (child != NULL) {
+        if (child->function == function) {
+            return child;
+        }
+        child = child->next_sibling;
+    }
+    child = calloc(1, sizeof(lmsm_profile_frame));
+    child->function = function;
+    child->next_sibling = parent->first_child;
+    parent->first_child = child;
+    return child;
+}
+
+void lmsm_profile_sample(lmsm_profile *profile, lmsm *our_little_machine) {
+    lmsm_profile_frame *frame = &profile->root;
+    // each return address points just past the JAL in the calling function
+    int depth = 0;
+    for (int i = our_little_machine->code_size;
+         i <= our_little_machine->return_address_pointer && i < our_little_machine->memory_size; ++i) {
+        frame = lmsm_profile_child(frame, lmsm_profile_function_at(profile, our_little_machine->memory[i] - 1));
+        depth++;
+    }
+    if (depth > profile->deepest_stack) {
+        profile->deepest_stack = depth;
+    }
+    frame = lmsm_profile_child(frame, lmsm_profile_function_at(profile, our_little_machine->program_counter));
+    frame->samples++;
+}
+
+void lmsm_profile_run(lmsm_profile *profile, lmsm *our_little_machine) {
+    our_little_machine->status = STATUS_RUNNING;
+    while (our_little_machine->status != STATUS_HALTED) {
+        int program_counter = our_little_machine->program_counter;
+        if (0 <= program_counter && program_counter < profile->code_size) {
+            profile->cycles[program_counter]++;
+        }
+        profile->total_cycles++;
+        if (--profile->countdown <= 0) {
+            profile->countdown = profile->sample_interval;
+            lmsm_profile_sample(profile, our_little_machine);
+        }
+        lmsm_step(our_little_machine);
+    }
+}
+
+//======================================================
+// Reporting
+//======================================================
+
+double lmsm_profile_percent(lmsm_profile *profile, long cycles) {
+    return profile->total_cycles ? 100.0 * (double) cycles / (double) profile->total_cycles : 0.0;
+}
+
+void lmsm_profile_print_report(lmsm_profile *profile, FILE *out) {
+    fprintf(out, "Total cycles: %ld\n\n", profile->total_cycles);
+
+    fprintf(out, "%-24s %10s %7s\n", "Function", "Cycles", "%");
+    for (int function = 0; function < profile->function_count; ++function) {
+        long cycles = 0;
+        for (int slot = 0; slot < profile->code_size; ++slot) {
+            if (profile->function_of[slot] == function) {
+                cycles += profile->cycles[slot];
+            }
+        }
+        fprintf(out, "%-24s %10ld %6.1f%%\n", profile->function_names[function], cycles,
+                lmsm_profile_percent(profile, cycles));
+    }
+
+    fprintf(out, "\n%-24s %10s %7s\n", "Source Line", "Cycles", "%");
+    int last_line = 0;
+    while (1) {
+        // print lines in ascending order, folding together every slot generated by the same line
+        int line = 0;
+        for (int slot = 0; slot < profile->code_size; ++slot) {
+            int candidate = profile->source_of[slot].line;
+            if (candidate > last_line && (line == 0 || candidate < line)) {
+                line = candidate;
+            }
+        }
+        if (line == 0) {
+            break;
+        }
+        long cycles = 0;
+        for (int slot = 0; slot < profile->code_size; ++slot) {
+            if (profile->source_of[slot].line == line) {
+                cycles += profile->cycles[slot];
+            }
+        }
+        if (cycles > 0) {
+            fprintf(out, "%-24d %10ld %6.1f%%\n", line, cycles, lmsm_profile_percent(profile, cycles));
+        }
+        last_line = line;
+    }
+}
+
+void lmsm_profile_print_frame(lmsm_profile *profile, lmsm_profile_frame *frame, char *path, int length, FILE *out) {
+    char *name = profile->function_names[frame->function];
+    int name_length = (int) strlen(name);
+    if (length > 0) {
+        path[length++] = ';';
+    }
+    memcpy(path + length, name, name_length);
+    length += name_length;
+    path[length] = '\0';
+
+    if (frame->samples > 0) {
+        fprintf(out, "%s %ld\n", path, frame->samples);
+    }
+    lmsm_profile_frame *child = frame->first_child;
+    while (child != NULL) {
+        lmsm_profile_print_frame(profile, child, path, length, out);
+        child = child->next_sibling;
+    }
+}
+
+void lmsm_profile_print_folded(lmsm_profile *profile, FILE *out) {
+    // a stack is at most one frame per return address plus the current function
+    size_t longest_name = 0;
+    for (int i = 0; i < profile->function_count; ++i) {
+        if (strlen(profile->function_names[i]) > longest_name) {
+            longest_name = strlen(profile->function_names[i]);
+        }
+    }
+    char *path = calloc((longest_name + 1) * (profile->deepest_stack + 2) + 1, sizeof(char));
+    lmsm_profile_frame *child = profile->root.first_child;
+    while (child != NULL) {
+        lmsm_profile_print_frame(profile, child, path, 0, out);
+        child = child->next_sibling;
+    }
+    free(path);
+}
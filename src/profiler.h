@@ -0,0 +1,58 @@
+#ifndef LMSM_PROFILER_H
+#define LMSM_PROFILER_H
+
+#include <stdio.h>
+#include "lmsm.h"
+#include "assembler.h"
+#include "firth.h"
+
+#define PROFILE_MAX_FUNCTIONS 100
+
+//===================================================================
+//  A node in the calling context tree, one per distinct call stack
+//===================================================================
+
+typedef struct lmsm_profile_frame {
+    int function;                             // index into the function names of the profile
+    long samples;                             // samples taken with this frame on top of the stack
+    struct lmsm_profile_frame *first_child;   // frames called from this one
+    struct lmsm_profile_frame *next_sibling;  // other frames called from the same parent
+} lmsm_profile_frame;
+
+//===================================================================
+//  Cycle counts and call stack samples for a single program
+//===================================================================
+
+typedef struct lmsm_profile {
+    char *function_names[PROFILE_MAX_FUNCTIONS + 1]; // function 0 is the top level program
+    int function_count;
+    int code_size;                                   // slots of code, the arrays below are this long
+    int *function_of;                                // the function that owns each code slot
+    asm_source_location *source_of;                  // Firth (or assembly) location of each code slot
+    long *cycles;                                    // instructions retired at each code slot
+    long total_cycles;
+    int deepest_stack;                               // most return addresses seen in a sample
+    int sample_interval;                             // take a call stack sample every N steps
+    int countdown;
+    lmsm_profile_frame root;                         // the (empty) stack below the top level
+} lmsm_profile;
+
+//=====================================================
+// API
+//=====================================================
+
+// builds a profile for an assembled program, firth may be NULL for plain assembly
+lmsm_profile *lmsm_profile_create(asm_compilation_result *assembly, firth_compilation_result *firth, int sample_interval);
+
+void lmsm_profile_delete(lmsm_profile *profile);
+
+// runs the machine to completion, recording every step in the profile
+void lmsm_profile_run(lmsm_profile *profile, lmsm *our_little_machine);
+
+// prints cycles per function and per source line
+void lmsm_profile_print_report(lmsm_profile *profile, FILE *out);
+
+// prints the sampled call stacks in the folded format used by flamegraph.pl
+void lmsm_profile_print_folded(lmsm_profile *profile, FILE *out);
+
+#endif //LMSM_PROFILER_H
@@ -4,142 +4,638 @@
 #include "assembler.h"
 #include "firth.h"
 #include "lmsm.h"
+#include "profiler.h"
+#include "trace.h"
+#include "history.h"
+#include "analyzer.h"
+#include "object.h"
+#include "checkpoint.h"
+#include "linker.h"
+#include "source.h"
 #include <stdlib.h>
 
-char * repl_read_file(char * filename){
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
+// the most recently loaded program, kept around for debug info
+asm_compilation_result *repl_assembly = NULL;
+firth_compilation_result *repl_firth = NULL;
+
+// the file and assembly of the program, if it can be reloaded
+char repl_source_file[100] = {0};
+char *repl_source = NULL;
+
+void repl_keep_results(asm_compilation_result *assembly, firth_compilation_result *firth) {
+    if (repl_assembly) {
+        asm_delete_compilation_result(repl_assembly);
+    }
+    if (repl_firth) {
+        firth_delete_compilation_result(repl_firth);
+    }
+    repl_assembly = assembly;
+    repl_firth = firth;
+    free(repl_source);
+    repl_source = NULL;
+}
+
+// whether programs go through the peephole optimiser
+int repl_optimize = 0;
+
+void repl_set_optimize(int optimize) {
+    repl_optimize = optimize;
+}
+
+asm_compilation_result *repl_assemble(lmsm *our_little_machine, char *src) {
+    if (repl_optimize) {
+        return asm_assemble_optimized(src, our_little_machine->code_size, our_little_machine->address_radix);
+    }
+    return asm_assemble_for(src, our_little_machine->code_size, our_little_machine->address_radix);
+}
+
+// compiles Firth straight to instructions for the machine, *result is NULL after a Firth error
+firth_compilation_result *repl_compile_firth(lmsm *our_little_machine, char *src, int emit_text,
+                                             asm_compilation_result **result) {
+    *result = asm_make_sized_compilation_result(our_little_machine->code_size, our_little_machine->address_radix);
+    (*result)->optimized = repl_optimize;
+    firth_compilation_result *firth = firth_compile_to(src, *result, emit_text);
+    if (firth->error) {
+        asm_delete_compilation_result(*result);
+        *result = NULL;
+    }
+    return firth;
+}
+
+// remembers where the kept program came from, taking ownership of the assembly
+void repl_keep_source(char *filename, char *assembly) {
+    free(repl_source);
+    repl_source_file[0] = '\0';
+    strncat(repl_source_file, filename, sizeof(repl_source_file) - 1);
+    repl_source = assembly;
+}
+
+// maps a source file in place, returns NULL (after reporting) if it cannot be read
+lmsm_source *repl_open_file(char *filename) {
+    lmsm_source *source = lmsm_source_open(filename);
+    if (source == NULL) {
         printf("Unknown file: '%s'\n\n", filename);
-        return "";
-    } else {
-        fseek(file, 0, SEEK_END);
-        long file_size = ftell(file);
-        rewind(file);
-        char *contents = malloc(file_size + 1);
-        fread(contents, 1, file_size, file);
-        fclose(file);
-        contents[file_size] = 0;
-        return contents;
     }
+    return source;
 }
 
 int repl_load_file(lmsm *our_little_machine, char *filename) {
-    char *contents = repl_read_file(filename);
-    printf("Loading:\n%s\n\n", contents);
-    asm_compilation_result *result = asm_assemble(contents);
+    lmsm_object *object = lmsm_object_open(filename);
+    if (object) {
+        printf("Loading object: %s (%u slots)\n\n", filename, object->header->code_length);
+        int loaded = lmsm_object_load(object, our_little_machine);
+        if (!loaded) {
+            lmsm_object_close(object);
+            printf("Unsupported memory layout: '%s'\n\n", filename);
+            return 0;
+        }
+        // enough of the program for the profiler and source locations, but not to reload
+        repl_keep_results(lmsm_object_result(object), NULL);
+        lmsm_object_close(object);
+        return 1;
+    }
+    lmsm_source *source = repl_open_file(filename);
+    if (source == NULL) {
+        return 0;
+    }
+    printf("Loading:\n%s\n\n", source->text);
+    asm_compilation_result *result = repl_assemble(our_little_machine, source->text);
     if (result->error) {
         printf("Assembly Error:\n%s\n\n", result->error);
+        asm_delete_compilation_result(result);
+        lmsm_source_close(source);
         return 0;
     } else {
         lmsm_reset(our_little_machine);
-        lmsm_load(our_little_machine, result->code, 100);
+        lmsm_clear_input(our_little_machine);
+        lmsm_load(our_little_machine, result->code, result->code_size);
+        repl_keep_results(result, NULL);
+        // reloading compares against this after the file has changed, so it cannot be the mapping
+        repl_keep_source(filename, strndup(source->text, source->length));
+        lmsm_source_close(source);
         return 1;
     }
 }
 
+// assembles an assembly or .firth file for the machine's layout, returns NULL (after reporting) on any error
+asm_compilation_result *repl_assemble_file(lmsm *our_little_machine, char *filename, firth_compilation_result **firth) {
+    *firth = NULL;
+    lmsm_source *source = repl_open_file(filename);
+    if (source == NULL) {
+        return NULL;
+    }
+    asm_compilation_result *result;
+    size_t length = strlen(filename);
+    if (length > strlen(".firth") && strcmp(filename + length - strlen(".firth"), ".firth") == 0) {
+        *firth = repl_compile_firth(our_little_machine, source->text, 0, &result);
+        if ((*firth)->error) {
+            printf("Compilation Error:\n%s\n\n", (*firth)->error);
+            lmsm_source_close(source);
+            return NULL;
+        }
+    } else {
+        result = repl_assemble(our_little_machine, source->text);
+    }
+    lmsm_source_close(source);
+    if (result->error) {
+        printf("Assembly Error:\n%s\n\n", result->error);
+        return NULL;
+    }
+    return result;
+}
+
+int repl_analyze_file(lmsm *our_little_machine, char *filename) {
+    firth_compilation_result *compilation_result;
+    asm_compilation_result *result = repl_assemble_file(our_little_machine, filename, &compilation_result);
+    if (result == NULL) {
+        return 0;
+    }
+    lmsm_analysis *analysis = lmsm_analyze(result->code, result->code_size, result->address_radix);
+    lmsm_analysis_print(analysis, stdout);
+    int bounded = analysis->worst_case_instructions != -1 &&
+                  analysis->max_value_stack != -1 &&
+                  analysis->max_return_stack != -1;
+    lmsm_analysis_delete(analysis);
+    asm_delete_compilation_result(result);
+    if (compilation_result) {
+        firth_delete_compilation_result(compilation_result);
+    }
+    return bounded;
+}
+
+int repl_emit_object(lmsm *our_little_machine, char *filename, char *object_filename) {
+    firth_compilation_result *compilation_result;
+    asm_compilation_result *result = repl_assemble_file(our_little_machine, filename, &compilation_result);
+    if (result == NULL) {
+        return 0;
+    }
+    if (compilation_result) {
+        // the object keeps the source map, but not the Firth result that reads it
+        firth_map_source(compilation_result, result);
+    }
+    int written = lmsm_object_write(result, 1, 0, object_filename);
+    if (!written) {
+        printf("Unable to write: '%s'\n", object_filename);
+    }
+    asm_delete_compilation_result(result);
+    if (compilation_result) {
+        firth_delete_compilation_result(compilation_result);
+    }
+    return written;
+}
+
+// library modules stay cached between links until the layout changes
+lmsm_linker *repl_linker = NULL;
+
+int repl_link_files(lmsm *our_little_machine, char *filename, char **libraries, int library_count) {
+    if (repl_linker && (repl_linker->code_size != our_little_machine->code_size ||
+                        repl_linker->address_radix != our_little_machine->address_radix)) {
+        lmsm_linker_delete(repl_linker);
+        repl_linker = NULL;
+    }
+    if (repl_linker == NULL) {
+        repl_linker = lmsm_linker_create(our_little_machine->code_size, our_little_machine->address_radix);
+    }
+    lmsm_source *source = repl_open_file(filename);
+    if (source == NULL) {
+        return 0;
+    }
+    asm_compilation_result *result = lmsm_linker_assemble(repl_linker, source->text, filename);
+    lmsm_source_close(source);
+    if (result == NULL) {
+        printf("%s\n\n", repl_linker->error);
+        return 0;
+    }
+    int *code = malloc(sizeof(int) * our_little_machine->code_size);
+    int length = lmsm_link(repl_linker, result, libraries, library_count, code);
+    if (length == -1) {
+        printf("Link Error:\n%s\n\n", repl_linker->error);
+        asm_delete_compilation_result(result);
+        free(code);
+        return 0;
+    }
+    printf("Linked: %s (%d slots)\n\n", filename, length);
+    lmsm_reset(our_little_machine);
+    lmsm_clear_input(our_little_machine);
+    lmsm_load(our_little_machine, code, our_little_machine->code_size);
+    // the job is at slot 0, so its debug info still lines up
+    repl_keep_results(result, NULL);
+    free(code);
+    return 1;
+}
+
+void repl_link(lmsm *our_little_machine, char *args) {
+    char *libraries[20];
+    int library_count = 0;
+    char *job = strtok(args, " ");
+    char *library = strtok(NULL, " ");
+    while (library != NULL && library_count < 20) {
+        libraries[library_count++] = library;
+        library = strtok(NULL, " ");
+    }
+    if (job == NULL) {
+        printf("usage: link <file_name> [<library> ...]\n");
+        return;
+    }
+    repl_link_files(our_little_machine, job, libraries, library_count);
+}
+
 int repl_comp_firth(lmsm *our_little_machine, char *filename) {
-    char *contents = repl_read_file(filename);
-    printf("Compiling:\n%s\n\n", contents);
-    firth_compilation_result *compilation_result = firth_compile(contents);
+    lmsm_source *source = repl_open_file(filename);
+    if (source == NULL) {
+        return 0;
+    }
+    printf("Compiling:\n%s\n\n", source->text);
+    asm_compilation_result *result;
+    // the text is only for showing, and for reload to diff against
+    firth_compilation_result *compilation_result = repl_compile_firth(our_little_machine, source->text, 1, &result);
+    lmsm_source_close(source);
     if (compilation_result->error) {
         printf("Compilation Error:\n%s\n\n", compilation_result->error);
         return 0;
     }
     printf("Assembly:\n%s\n\n", compilation_result->lmsm_assembly);
-    asm_compilation_result *result = asm_assemble(compilation_result->lmsm_assembly);
+    if (compilation_result->removed_functions > 0) {
+        printf("Unused functions left out: %d (%d slots)\n\n", compilation_result->removed_functions,
+               compilation_result->removed_slots);
+    }
     if (result->error) {
         printf("Assembly Error:\n%s\n\n", result->error);
         return 0;
     } else {
         lmsm_reset(our_little_machine);
-        lmsm_load(our_little_machine, result->code, 100);
+        lmsm_clear_input(our_little_machine);
+        lmsm_load(our_little_machine, result->code, result->code_size);
+        repl_keep_results(result, compilation_result);
+        repl_keep_source(filename, strdup(compilation_result->lmsm_assembly));
         return 1;
     }
 }
 
 int repl_load_firth(lmsm *our_little_machine, char *src) {
     printf("Compiling:\n%s\n\n", src);
-    firth_compilation_result *compilation_result = firth_compile(src);
+    asm_compilation_result *result;
+    firth_compilation_result *compilation_result = repl_compile_firth(our_little_machine, src, 1, &result);
     if (compilation_result->error) {
         printf("Compilation Error:\n%s\n\n", compilation_result->error);
         return 0;
     }
     printf("Assembly:\n%s\n\n", compilation_result->lmsm_assembly);
-    asm_compilation_result *result = asm_assemble(compilation_result->lmsm_assembly);
+    if (compilation_result->removed_functions > 0) {
+        printf("Unused functions left out: %d (%d slots)\n\n", compilation_result->removed_functions,
+               compilation_result->removed_slots);
+    }
     if (result->error) {
         printf("Assembly Error:\n%s\n\n", result->error);
         return 0;
     } else {
         lmsm_reset(our_little_machine);
-        lmsm_load(our_little_machine, result->code, 100);
+        lmsm_clear_input(our_little_machine);
+        lmsm_load(our_little_machine, result->code, result->code_size);
+        repl_keep_results(result, compilation_result);
         return 1;
     }
 }
 
 
+// prints memory ten slots to a line, code marks the program counter, otherwise the stack pointers are marked
+int repl_print_memory_to_buffer(lmsm *our_little_machine, char *output, int first, int last, int code) {
+    int wide = our_little_machine->address_radix != ADDRESS_RADIX;
+    int address_width = wide ? 4 : 3;
+    int value_width = wide ? 5 : 3;
+    int offset = 0;
+    for (int i = first; i <= last; ++i) {
+        if (i % 10 == 0 || i == first) {
+            offset += sprintf(output + offset, "  %0*d:  ", address_width, i);
+        }
+        int currentValue = our_little_machine->memory[i];
+        if (code && i == our_little_machine->program_counter) {
+            offset += sprintf(output + offset, "[%0*d] ", value_width, currentValue);
+        } else if (!code && i == our_little_machine->return_address_pointer) {
+            offset += sprintf(output + offset, "{%0*d} ", value_width, currentValue);
+        } else if (!code && i == our_little_machine->stack_pointer) {
+            offset += sprintf(output + offset, "[%0*d] ", value_width, currentValue);
+        } else {
+            offset += sprintf(output + offset, " %0*d  ", value_width, currentValue);
+        }
+        if (i % 10 == 9 || i == last) {
+            offset += sprintf(output + offset, "\n");
+        }
+    }
+    return offset;
+}
+
+// prints the 100 slot page holding the slot, the classic layout prints both of its pages instead
+int repl_print_page_to_buffer(lmsm *our_little_machine, char *output, int slot, char *title) {
+    int first = slot / 100 * 100;
+    int last = first + 99 < our_little_machine->memory_size ? first + 99 : our_little_machine->memory_size - 1;
+    int offset = sprintf(output, "==================== Memory %04d-%04d (%s) ====================\n", first, last, title);
+    offset += repl_print_memory_to_buffer(our_little_machine, output + offset, first, last, first < our_little_machine->code_size);
+    return offset;
+}
+
+// a buffer size that holds the state of the machine, whatever its memory size
+size_t repl_print_buffer_size(lmsm *our_little_machine) {
+    return (size_t) our_little_machine->memory_size * 16 + OUTPUT_BUFFER_SIZE + 5000;
+}
+
 void repl_print_to_buffer(lmsm *our_little_machine, char* output) {
+    int wide = our_little_machine->address_radix != ADDRESS_RADIX;
+    int address_width = wide ? 4 : 3;
+    int value_width = wide ? 5 : 3;
     int offset =       sprintf(output, "=========================== LMSM State ===========================\n");
-    offset += sprintf(output + offset, "Program Counter:  %02d                      Current Instruction: %03d\n", our_little_machine->program_counter, our_little_machine->current_instruction);
+    offset += sprintf(output + offset, "Program Counter:  %0*d                      Current Instruction: %0*d\n",
+                      wide ? 4 : 2, our_little_machine->program_counter, value_width, our_little_machine->current_instruction);
 
-    offset += sprintf(output + offset, "Accumulator:     %03d                      Status: %d\n", our_little_machine->accumulator, our_little_machine->status);
+    offset += sprintf(output + offset, "Accumulator:     %0*d                      Status: %d\n", value_width, our_little_machine->accumulator, our_little_machine->status);
 
     offset += sprintf(output + offset, "Stack Pointer: ");
-    offset += sprintf(output + offset, "%03d\n", our_little_machine->stack_pointer);
+    offset += sprintf(output + offset, "%0*d\n", address_width, our_little_machine->stack_pointer);
 
     offset += sprintf(output + offset, "  Value Stack: [");
-    for (int i = TOP_OF_MEMORY; i >= our_little_machine->stack_pointer; --i) {
-        if (i != TOP_OF_MEMORY) {
-            offset += sprintf(output + offset, ", ", our_little_machine->memory[i]);
+    int top_of_memory = our_little_machine->memory_size - 1;
+    for (int i = top_of_memory; i >= our_little_machine->stack_pointer; --i) {
+        if (i != top_of_memory) {
+            offset += sprintf(output + offset, ", ");
         }
-        offset += sprintf(output + offset, "%03d", our_little_machine->memory[i]);
+        offset += sprintf(output + offset, "%0*d", value_width, our_little_machine->memory[i]);
     }
     offset += sprintf(output + offset, "]\n");
 
     offset += sprintf(output + offset, "Return Address Pointer:");
-    offset += sprintf(output + offset, " %03d\n", our_little_machine->return_address_pointer);
+    offset += sprintf(output + offset, " %0*d\n", address_width, our_little_machine->return_address_pointer);
     offset += sprintf(output + offset, "  Return Address Stack: [");
-    for (int i = 100; i <= our_little_machine->return_address_pointer; ++i) {
-        if (i != 100) {
-            offset += sprintf(output + offset, ", ", our_little_machine->memory[i]);
+    int bottom = our_little_machine->code_size;
+    for (int i = bottom; i <= our_little_machine->return_address_pointer; ++i) {
+        if (i != bottom) {
+            offset += sprintf(output + offset, ", ");
         }
-        offset += sprintf(output + offset, "%03d", our_little_machine->memory[i]);
+        offset += sprintf(output + offset, "%0*d", value_width, our_little_machine->memory[i]);
     }
     offset += sprintf(output + offset, "]\n\n");
 
-    offset += sprintf(output + offset, "========================== Lower Memory ==========================\n");
-    for (int i = 0; i < 100; ++i) {
-        if (i % 10 == 0) {
-            offset += sprintf(output + offset, "  %03d:  ", i);
+    if (wide) {
+        // too much memory to print it all, show the pages in use
+        int program_counter = our_little_machine->program_counter;
+        int return_address_page = our_little_machine->return_address_pointer < bottom ? bottom : our_little_machine->return_address_pointer;
+        int stack_page = our_little_machine->stack_pointer > top_of_memory ? top_of_memory : our_little_machine->stack_pointer;
+        if (0 <= program_counter && program_counter <= top_of_memory) {
+            offset += repl_print_page_to_buffer(our_little_machine, output + offset, program_counter, "program counter");
         }
-        int currentValue = our_little_machine->memory[i];
-        if (i == our_little_machine->program_counter) {
-            offset += sprintf(output + offset, "[%03d] ", currentValue);
-        } else {
-            offset += sprintf(output + offset, " %03d  ", currentValue);
+        offset += repl_print_page_to_buffer(our_little_machine, output + offset, return_address_page, "return address stack");
+        if (stack_page / 100 != return_address_page / 100) {
+            offset += repl_print_page_to_buffer(our_little_machine, output + offset, stack_page, "value stack");
         }
-        if (i % 10 == 9) {
-            offset += sprintf(output + offset, "\n");
+    } else {
+        offset += sprintf(output + offset, "========================== Lower Memory ==========================\n");
+        offset += repl_print_memory_to_buffer(our_little_machine, output + offset, 0, bottom - 1, 1);
+        offset += sprintf(output + offset, "========================== Upper Memory ==========================\n");
+        offset += repl_print_memory_to_buffer(our_little_machine, output + offset, bottom, top_of_memory, 0);
+    }
+    offset += sprintf(output + offset, "==================================================================\n");
+    sprintf(output + offset, "Output: %s\n", our_little_machine->output_buffer);
+}
+
+void repl_print(lmsm *our_little_machine) {
+    char *output = calloc(repl_print_buffer_size(our_little_machine), sizeof(char));
+    repl_print_to_buffer(our_little_machine, output);
+    printf("%s", output);
+    free(output);
+}
+
+void repl_print_page(lmsm *our_little_machine, int page) {
+    if (page < 0 || page * 100 >= our_little_machine->memory_size) {
+        printf("No page %d, memory has %d slots\n", page, our_little_machine->memory_size);
+        return;
+    }
+    char *output = calloc(repl_print_buffer_size(our_little_machine), sizeof(char));
+    repl_print_page_to_buffer(our_little_machine, output, page * 100, "page");
+    printf("%s", output);
+    free(output);
+}
+
+void repl_layout(lmsm *our_little_machine, char *args) {
+    int configured;
+    if (strcmp("classic", args) == 0) {
+        configured = lmsm_configure(our_little_machine, TOP_OF_MEMORY + 1, ADDRESS_RADIX);
+    } else {
+        configured = lmsm_configure(our_little_machine, atoi(args), WIDE_ADDRESS_RADIX);
+    }
+    if (!configured) {
+        printf("usage: layout classic | layout <even memory size from %d to %d>\n", 2 * CODE_SIZE, MAX_MEMORY_SIZE);
+        return;
+    }
+    repl_keep_results(NULL, NULL);
+    printf("%d slots of memory, %d of them code, %d digit addresses\n", our_little_machine->memory_size,
+           our_little_machine->code_size, our_little_machine->address_radix == ADDRESS_RADIX ? 2 : 4);
+}
+
+void repl_profile(lmsm *our_little_machine, char *filename) {
+    if (repl_assembly == NULL) {
+        printf("No program loaded\n");
+        return;
+    }
+    lmsm_profile *profile = lmsm_profile_create(repl_assembly, repl_firth, 1);
+    lmsm_profile_run(profile, our_little_machine);
+    lmsm_profile_print_report(profile, stdout);
+    if (filename) {
+        FILE *file = fopen(filename, "w");
+        if (file == NULL) {
+            printf("Unable to write: '%s'\n", filename);
+        } else {
+            lmsm_profile_print_folded(profile, file);
+            fclose(file);
+            printf("\nFolded stacks written to %s\n", filename);
         }
+    } else {
+        printf("\nFolded stacks:\n");
+        lmsm_profile_print_folded(profile, stdout);
     }
-    offset += sprintf(output + offset, "========================== Upper Memory ==========================\n");
-    for (int i = 100; i <= TOP_OF_MEMORY; ++i) {
-        if (i % 10 == 0) {
-            offset += sprintf(output + offset, "  %03d:  ", i);
+    lmsm_profile_delete(profile);
+}
+
+void repl_trace(lmsm *our_little_machine, char *args) {
+    if (strncmp("on", args, strlen("on")) == 0) {
+        char *filename = strlen(args) > strlen("on ") ? args + strlen("on ") : NULL;
+        if (our_little_machine->trace) {
+            lmsm_trace_delete(our_little_machine->trace);
         }
-        int currentValue = our_little_machine->memory[i];
-        if (i == our_little_machine->return_address_pointer) {
-            offset += sprintf(output + offset, "{%03d} ", currentValue);
-        } else if (i == our_little_machine->stack_pointer) {
-            offset += sprintf(output + offset, "[%03d] ", currentValue);
+        our_little_machine->trace = lmsm_trace_create(TRACE_DEFAULT_BLOCKS, our_little_machine->address_radix, filename);
+        if (our_little_machine->trace == NULL) {
+            printf("Unable to write: '%s'\n", filename);
         } else {
-            offset += sprintf(output + offset, " %03d  ", currentValue);
+            printf("Tracing to %s\n", filename ? filename : "memory");
         }
-        if (i % 10 == 9) {
-            offset += sprintf(output + offset, "\n");
+    } else if (strcmp("off", args) == 0) {
+        if (our_little_machine->trace) {
+            lmsm_trace_delete(our_little_machine->trace);
+            our_little_machine->trace = NULL;
         }
+    } else if (strcmp("dump", args) == 0) {
+        if (our_little_machine->trace) {
+            lmsm_trace_decode(our_little_machine->trace, stdout);
+        } else {
+            printf("Tracing is off\n");
+        }
+    } else {
+        printf("usage: trace on [file] | trace off | trace dump\n");
+    }
+}
+
+void repl_run(lmsm *our_little_machine) {
+    printf("Running...\n\n");
+    if (our_little_machine->breakpoint_count == 0 && our_little_machine->watchpoint_count == 0) {
+        lmsm_run(our_little_machine);
+        return;
+    }
+    stop_reason reason = lmsm_run_debug(our_little_machine);
+    if (reason == STOP_HALTED) {
+        return;
+    }
+    if (reason == STOP_BREAKPOINT) {
+        printf("Breakpoint at %02d\n", our_little_machine->program_counter);
+    } else {
+        printf("Watchpoint: %03d written with %03d\n", our_little_machine->watch_hit,
+               our_little_machine->memory[our_little_machine->watch_hit]);
+    }
+    repl_print(our_little_machine);
+}
+
+void repl_history(lmsm *our_little_machine, char *args) {
+    if (strncmp("on", args, strlen("on")) == 0) {
+        if (our_little_machine->history) {
+            lmsm_history_delete(our_little_machine->history);
+        }
+        our_little_machine->history = lmsm_history_create(atoi(args + strlen("on")));
+        printf("Recording up to %d steps of history\n", our_little_machine->history->max_entries);
+    } else if (strcmp("off", args) == 0) {
+        if (our_little_machine->history) {
+            lmsm_history_delete(our_little_machine->history);
+            our_little_machine->history = NULL;
+        }
+    } else {
+        printf("usage: history on [max steps] | history off\n");
     }
-    offset += sprintf(output + offset, "==================================================================\n");
-    sprintf(output + offset, "Output: %s\n", our_little_machine->output_buffer);
+}
+
+// instructions executed and slots written outside of a step are not in the undo log, so earlier steps can no
+// longer be undone
+void repl_forget_history(lmsm *our_little_machine) {
+    if (our_little_machine->history) {
+        lmsm_history_clear(our_little_machine->history);
+    }
+}
+
+// re-reads the loaded file and patches the code slots that changed, leaving the rest of the machine as it is
+void repl_reload(lmsm *our_little_machine) {
+    if (repl_source == NULL) {
+        printf("No program to reload\n");
+        return;
+    }
+    lmsm_source *source = repl_open_file(repl_source_file);
+    if (source == NULL) {
+        return;
+    }
+    if (source->length == 0) {
+        lmsm_source_close(source);
+        return; // emptied, there is nothing to patch in
+    }
+    char *assembly;
+    firth_compilation_result *firth = NULL;
+    if (repl_firth) {
+        firth = firth_compile_for(source->text, our_little_machine->code_size, our_little_machine->address_radix);
+        lmsm_source_close(source);
+        if (firth->error) {
+            printf("Compilation Error:\n%s\n\n", firth->error);
+            firth_delete_compilation_result(firth);
+            return;
+        }
+        assembly = strdup(firth->lmsm_assembly);
+    } else {
+        // kept as the source of the next reload
+        assembly = strndup(source->text, source->length);
+        lmsm_source_close(source);
+    }
+
+    int *changed = malloc(sizeof(int) * our_little_machine->code_size);
+    int changed_count = 0;
+    if (repl_assembly && asm_reassemble(repl_assembly, repl_source, assembly, changed, &changed_count)) {
+        for (int i = 0; i < changed_count; ++i) {
+            our_little_machine->memory[changed[i]] = repl_assembly->code[changed[i]];
+        }
+    } else {
+        // a failed update leaves the kept program unusable, so it goes either way
+        if (repl_assembly) {
+            asm_delete_compilation_result(repl_assembly);
+            repl_assembly = NULL;
+        }
+        asm_compilation_result *result = repl_assemble(our_little_machine, assembly);
+        if (result->error) {
+            printf("Assembly Error:\n%s\n\n", result->error);
+            asm_delete_compilation_result(result);
+            if (firth) {
+                firth_delete_compilation_result(firth);
+            }
+            free(assembly);
+            free(changed);
+            return;
+        }
+        for (int slot = 0; slot < result->code_size; ++slot) {
+            if (our_little_machine->memory[slot] != result->code[slot]) {
+                our_little_machine->memory[slot] = result->code[slot];
+                changed_count++;
+            }
+        }
+        repl_assembly = result;
+    }
+    free(changed);
+    if (firth) {
+        firth_delete_compilation_result(repl_firth);
+        repl_firth = firth;
+    }
+    free(repl_source);
+    repl_source = assembly;
+    if (changed_count > 0) {
+        repl_forget_history(our_little_machine);
+    }
+    printf("Reloaded: %s (%d slots changed)\n", repl_source_file, changed_count);
+}
+
+void repl_back(lmsm *our_little_machine, char *count) {
+    if (our_little_machine->history == NULL) {
+        printf("History is off, use 'history on' before running\n");
+        return;
+    }
+    long steps = (count && *count) ? atol(count) : 1;
+    long undone = lmsm_history_rewind(our_little_machine->history, our_little_machine, steps);
+    printf("Rewound %ld steps, %ld more available\n", undone, our_little_machine->history->steps);
+    repl_print(our_little_machine);
+}
+
+void repl_input(lmsm *our_little_machine, char *values) {
+    if (strcmp("clear", values) == 0) {
+        lmsm_clear_input(our_little_machine);
+        return;
+    }
+    char *value = strtok(values, " ");
+    while (value != NULL) {
+        if (!lmsm_queue_input(our_little_machine, atoi(value))) {
+            printf("No memory to queue input\n");
+            return;
+        }
+        value = strtok(NULL, " ");
+    }
+}
+
+void repl_checkpoint(lmsm *our_little_machine, char *args) {
+    char *steps = strtok(args, " ");
+    char *filename = strtok(NULL, " ");
+    if (steps == NULL || filename == NULL || atol(steps) <= 0) {
+        printf("usage: checkpoint <steps> <file>\n");
+        return;
+    }
+    printf("Running...\n\n");
+    lmsm_run_with_checkpoints(our_little_machine, atol(steps), filename);
 }
 
 void repl_process_command(lmsm *our_little_machine, char *line) {
@@ -153,10 +649,29 @@ void repl_process_command(lmsm *our_little_machine, char *line) {
         printf("  help or ? - prints this message\n");
         printf("  [l]oad <file_name> - loads a new program into the LMSM from a file\n");
         printf("  [c]omp <file_name> - compiles a Firth file into LMSM assembly, then loads it into memory\n");
+        printf("  optimize on | off - runs programs loaded afterwards through the peephole optimiser\n");
+        printf("  reload - re-reads the loaded file, reassembling only what changed, and patches it into memory\n");
+        printf("  link <file_name> [<library> ...] - assembles a program, then links the library functions it uses\n");
+        printf("                   (libraries are assembly or Firth, cached in memory and in <library>.lmo)\n");
         printf("  [s]tep - executes one step in the LMSM\n");
-        printf("  [r]un  - runs the current program\n");
+        printf("  [r]un  - runs the current program, stopping at breakpoints and watchpoints\n");
+        printf("  history on [max steps] | off - records an undo log of each step\n");
+        printf("  back or reverse-step [n] - undoes the last n steps (default 1)\n");
+        printf("  [un]break <slot> - stops a run before the instruction in the slot executes\n");
+        printf("  [un]watch <slot> - stops a run after the slot is written\n");
+        printf("  trace on [file] - records a compact trace of every step, in memory or an mmap'd file\n");
+        printf("  trace off | dump - stops tracing, or prints the recorded trace as assembly\n");
+        printf("  input <num> ... | clear - queues values for INP, which otherwise reads the command line\n");
+        printf("  save <file> - saves a checkpoint of the machine, including pending input and output\n");
+        printf("  restore <file> - restores a checkpoint saved by this or another process\n");
+        printf("  checkpoint <steps> <file> - runs the current program, saving a checkpoint every <steps> steps\n");
+        printf("  analyze - statically bounds the instructions and stack depths of the program in memory\n");
+        printf("  profile [file] - runs the current program, reporting cycles per function and source line\n");
+        printf("                   and writing folded call stacks for flamegraphs to the file, if given\n");
+        printf("  layout classic | <slots> - 2 digit addresses and 200 slots, or 4 digit addresses and more memory\n");
         printf("  rese[t]  - resets the LMSM\n");
         printf("  [p]rint  - prints the state of the LMSM\n");
+        printf("  page <n> - prints slots n*100 to n*100+99\n");
         printf("  [w]rite <num> <slot>  - saves the number in the given slot\n");
         printf("  [e]xec <num> - executes the raw asm_instruction\n");
         printf("  <any LMSM asm_instruction>  - executes a single asm_instruction (no label support)\n\n");
@@ -177,41 +692,93 @@ void repl_process_command(lmsm *our_little_machine, char *line) {
         char fileName[100] = {0};
         strncat(fileName, line + 2, 100);
         repl_comp_firth(our_little_machine, fileName);
+    } else if (strcmp("optimize on", line) == 0 || strcmp("optimize off", line) == 0) {
+        repl_set_optimize(strcmp("optimize on", line) == 0);
+    } else if (strcmp("reload", line) == 0) {
+        repl_reload(our_little_machine);
+    } else if (strncmp("link ", line, strlen("link ")) == 0) {
+        repl_link(our_little_machine, line + strlen("link "));
     } else if (strncmp("write ", line, strlen("write ")) == 0) {
         char *command = strtok(line, " ");
         char *num = strtok(NULL, " ");
         char *slot = strtok(NULL, " ");
-        our_little_machine->memory[atoi(slot)] = atoi(num);
+        if (slot && 0 <= atoi(slot) && atoi(slot) < our_little_machine->memory_size) {
+            repl_forget_history(our_little_machine);
+            our_little_machine->memory[atoi(slot)] = atoi(num);
+        }
     } else if (strncmp("w ", line, strlen("w ")) == 0) {
         char *command = strtok(line, " ");
         char *num = strtok(NULL, " ");
         char *slot = strtok(NULL, " ");
-        our_little_machine->memory[atoi(slot)] = atoi(num);
+        if (slot && 0 <= atoi(slot) && atoi(slot) < our_little_machine->memory_size) {
+            repl_forget_history(our_little_machine);
+            our_little_machine->memory[atoi(slot)] = atoi(num);
+        }
     } else if (strncmp("exec ", line, strlen("exec ")) == 0) {
         char *command = strtok(line, " ");
         char *raw = strtok(NULL, " ");
+        repl_forget_history(our_little_machine);
         lmsm_exec_instruction(our_little_machine, atoi(raw));
     } else if (strncmp("e ", line, strlen("e ")) == 0) {
         char *command = strtok(line, " ");
         char *raw = strtok(NULL, " ");
+        repl_forget_history(our_little_machine);
         lmsm_exec_instruction(our_little_machine, atoi(raw));
     } else if (strcmp("p", line) == 0 || strcmp("print", line) == 0) {
-        char output[5000] = {0};
-        repl_print_to_buffer(our_little_machine, output);
-        printf("%s", output);
+        repl_print(our_little_machine);
     } else if (strcmp("s", line) == 0 || strcmp("step", line) == 0) {
         lmsm_step(our_little_machine);
-        char output[5000] = {0};
-        repl_print_to_buffer(our_little_machine, output);
-        printf("%s", output);
+        repl_print(our_little_machine);
     } else if (strcmp("t", line) == 0 || strcmp("reset", line) == 0) {
         lmsm_reset(our_little_machine);
-        char output[5000] = {0};
-        repl_print_to_buffer(our_little_machine, output);
-        printf("%s", output);
+        repl_print(our_little_machine);
+    } else if (strncmp("layout ", line, strlen("layout ")) == 0) {
+        repl_layout(our_little_machine, line + strlen("layout "));
+    } else if (strncmp("page ", line, strlen("page ")) == 0) {
+        repl_print_page(our_little_machine, atoi(line + strlen("page ")));
     } else if (strcmp("r", line) == 0 || strcmp("run", line) == 0) {
-        printf("Running...\n\n");
-        lmsm_run(our_little_machine);
+        repl_run(our_little_machine);
+    } else if (strncmp("history ", line, strlen("history ")) == 0) {
+        repl_history(our_little_machine, line + strlen("history "));
+    } else if (strcmp("back", line) == 0 || strcmp("reverse-step", line) == 0) {
+        repl_back(our_little_machine, NULL);
+    } else if (strncmp("back ", line, strlen("back ")) == 0) {
+        repl_back(our_little_machine, line + strlen("back "));
+    } else if (strncmp("reverse-step ", line, strlen("reverse-step ")) == 0) {
+        repl_back(our_little_machine, line + strlen("reverse-step "));
+    } else if (strncmp("break ", line, strlen("break ")) == 0) {
+        lmsm_set_breakpoint(our_little_machine, atoi(line + strlen("break ")), 1);
+    } else if (strncmp("unbreak ", line, strlen("unbreak ")) == 0) {
+        lmsm_set_breakpoint(our_little_machine, atoi(line + strlen("unbreak ")), 0);
+    } else if (strncmp("watch ", line, strlen("watch ")) == 0) {
+        lmsm_set_watchpoint(our_little_machine, atoi(line + strlen("watch ")), 1);
+    } else if (strncmp("unwatch ", line, strlen("unwatch ")) == 0) {
+        lmsm_set_watchpoint(our_little_machine, atoi(line + strlen("unwatch ")), 0);
+    } else if (strncmp("trace ", line, strlen("trace ")) == 0) {
+        repl_trace(our_little_machine, line + strlen("trace "));
+    } else if (strncmp("input ", line, strlen("input ")) == 0) {
+        repl_input(our_little_machine, line + strlen("input "));
+    } else if (strncmp("save ", line, strlen("save ")) == 0) {
+        if (!lmsm_checkpoint_save(our_little_machine, line + strlen("save "))) {
+            printf("Unable to write: '%s'\n", line + strlen("save "));
+        }
+    } else if (strncmp("restore ", line, strlen("restore ")) == 0) {
+        if (!lmsm_checkpoint_restore(our_little_machine, line + strlen("restore "))) {
+            printf("Not a checkpoint: '%s'\n", line + strlen("restore "));
+        } else {
+            repl_keep_results(NULL, NULL);
+        }
+    } else if (strncmp("checkpoint ", line, strlen("checkpoint ")) == 0) {
+        repl_checkpoint(our_little_machine, line + strlen("checkpoint "));
+    } else if (strcmp("analyze", line) == 0) {
+        lmsm_analysis *analysis = lmsm_analyze(our_little_machine->memory, our_little_machine->code_size,
+                                               our_little_machine->address_radix);
+        lmsm_analysis_print(analysis, stdout);
+        lmsm_analysis_delete(analysis);
+    } else if (strcmp("profile", line) == 0) {
+        repl_profile(our_little_machine, NULL);
+    } else if (strncmp("profile ", line, strlen("profile ")) == 0) {
+        repl_profile(our_little_machine, line + strlen("profile "));
     } else if (strncmp("f:", line, strlen("f:")) == 0) {
         printf("Loading Firth...\n\n");
         repl_load_firth(our_little_machine, line + 2);
@@ -224,12 +791,14 @@ void repl_process_command(lmsm *our_little_machine, char *line) {
         strncpy(start, line, 100);
         char *firstWord = strtok(start, " ");
         if (asm_is_instruction(firstWord)) {
-            asm_compilation_result *result = asm_assemble(line);
+            asm_compilation_result *result = asm_assemble_for(line, our_little_machine->code_size,
+                                                              our_little_machine->address_radix);
             if (result->error) {
                 printf("ERROR: %s\n", result->error);
             } else if(result->root->next != NULL) {
                 printf("Only one asm_instruction can be executed at a time");
             } else {
+                repl_forget_history(our_little_machine);
                 lmsm_exec_instruction(our_little_machine, result->code[0]);
                 if (result->code[1]) {
                     lmsm_exec_instruction(our_little_machine, result->code[1]); // support 2-asm_instruction pseudo-instructions
@@ -5,6 +5,19 @@
 
 int repl_load_file(lmsm *our_little_machine, char *filename);
 
+// prints the static analysis of an assembly or .firth file, returns 1 if everything is bounded
+int repl_analyze_file(lmsm *our_little_machine, char *filename);
+
+// assembles (or compiles) a source file into an object file for the machine's layout, returns 1 on success
+int repl_emit_object(lmsm *our_little_machine, char *filename, char *object_filename);
+
+// assembles a program as a module and links it against library sources (or their cached .lmo files),
+// then loads the result, returns 1 on success
+int repl_link_files(lmsm *our_little_machine, char *filename, char **libraries, int library_count);
+
+// sets whether programs loaded from now on go through the peephole optimiser
+void repl_set_optimize(int optimize);
+
 void repl_start(lmsm *our_little_machine);
 
 #endif //LMSM_REPL_H
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+
+//======================================================
+// Mapping
+//======================================================
+
+// maps the file followed by at least one zero byte, returns 0 if it cannot be mapped
+int lmsm_source_map(lmsm_source *source, int fd, size_t length) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    // the tail of the last page of a mapped file reads as zeros, and when the file fills it exactly the anonymous
+    // page reserved after it does instead
+    size_t mapping_size = (length / page + 1) * page;
+    void *reserved = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        return 0;
+    }
+    if (mmap(reserved, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(reserved, mapping_size);
+        return 0;
+    }
+    source->text = reserved;
+    source->mapping = reserved;
+    source->mapping_size = mapping_size;
+    return 1;
+}
+
+// reads whatever cannot be mapped, pipes and the like
+int lmsm_source_read(lmsm_source *source, int fd) {
+    size_t capacity = 4096;
+    size_t length = 0;
+    char *text = malloc(capacity);
+    ssize_t count;
+    while ((count = read(fd, text + length, capacity - length - 1)) > 0) {
+        length += count;
+        if (capacity - length == 1) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+    }
+    if (count < 0) {
+        free(text);
+        return 0;
+    }
+    text[length] = '\0';
+    source->text = text;
+    source->length = length;
+    return 1;
+}
+
+//======================================================
+// Main API
+//======================================================
+
+lmsm_source *lmsm_source_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    lmsm_source *source = calloc(1, sizeof(lmsm_source));
+    struct stat info;
+    int opened = 0;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        source->length = (size_t) info.st_size;
+        opened = lmsm_source_map(source, fd, source->length);
+    }
+    if (!opened) {
+        source->length = 0;
+        opened = lmsm_source_read(source, fd);
+    }
+    close(fd);
+    if (!opened) {
+        free(source);
+        return NULL;
+    }
+    return source;
+}
+
+void lmsm_source_close(lmsm_source *source) {
+    if (source->mapping) {
+        munmap(source->mapping, source->mapping_size);
+    } else {
+        free(source->text);
+    }
+    free(source);
+}
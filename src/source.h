@@ -0,0 +1,28 @@
+#ifndef LMSM_SOURCE_H
+#define LMSM_SOURCE_H
+
+#include <stddef.h>
+
+//===================================================================
+//  A read only view of a source file, mapped rather than copied
+//  where the file allows it. The text is always NUL terminated, so
+//  the tokenizers can scan it in place.
+//===================================================================
+
+typedef struct lmsm_source {
+    char *text;            // read only
+    size_t length;
+    void *mapping;         // NULL when the file was read instead
+    size_t mapping_size;
+} lmsm_source;
+
+//=====================================================
+// API
+//=====================================================
+
+// opens a view of a whole file, returns NULL if it cannot be read
+lmsm_source *lmsm_source_open(char *path);
+
+void lmsm_source_close(lmsm_source *source);
+
+#endif //LMSM_SOURCE_H
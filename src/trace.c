@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "assembler.h"
+
+#define TRACE_SEQUENTIAL_PC 1
+#define TRACE_SAME_INSTRUCTION 2
+#define TRACE_SAME_ACCUMULATOR 4
+#define TRACE_SAME_STACK_POINTER 8
+
+//======================================================
+// Varint Encoding
+//======================================================
+
+unsigned int lmsm_trace_zigzag(int value) {
+    return ((unsigned int) value << 1) ^ (unsigned int) (value >> 31);
+}
+
+int lmsm_trace_unzigzag(unsigned int value) {
+    return (int) (value >> 1) ^ -(int) (value & 1);
+}
+
+unsigned char *lmsm_trace_put_varint(unsigned char *cursor, unsigned int value) {
+    while (value >= 0x80) {
+        *cursor++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    *cursor++ = (unsigned char) value;
+    return cursor;
+}
+
+// reads a varint that must end before end, returns NULL if it does not or is longer than an int needs
+unsigned char *lmsm_trace_get_varint(unsigned char *cursor, unsigned char *end, unsigned int *value) {
+    unsigned int result = 0;
+    int shift = 0;
+    while (cursor < end && *cursor & 0x80) {
+        if (shift == 28) {
+            return NULL;
+        }
+        result |= (unsigned int) (*cursor++ & 0x7F) << shift;
+        shift += 7;
+    }
+    if (cursor == end) {
+        return NULL;
+    }
+    result |= (unsigned int) *cursor++ << shift;
+    *value = result;
+    return cursor;
+}
+
+//======================================================
+// Constructors/Destructors
+//======================================================
+
+lmsm_trace *lmsm_trace_create(int block_count, int address_radix, char *path) {
+    size_t region_size = sizeof(lmsm_trace_header) + (size_t) block_count * TRACE_BLOCK_SIZE;
+    lmsm_trace_header *header;
+    int fd = -1;
+    if (path != NULL) {
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return NULL;
+        }
+        if (ftruncate(fd, (off_t) region_size) != 0) {
+            close(fd);
+            return NULL;
+        }
+        header = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header == MAP_FAILED) {
+            close(fd);
+            return NULL;
+        }
+    } else {
+        header = calloc(1, region_size);
+    }
+    header->magic = TRACE_MAGIC;
+    header->version = TRACE_VERSION;
+    header->block_size = TRACE_BLOCK_SIZE;
+    header->block_count = block_count;
+    header->address_radix = address_radix;
+    header->blocks_written = 0;
+
+    lmsm_trace *trace = calloc(1, sizeof(lmsm_trace));
+    trace->header = header;
+    trace->region_size = region_size;
+    trace->fd = fd;
+    return trace;
+}
+
+lmsm_trace *lmsm_trace_open(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(lmsm_trace_header)) {
+        close(fd);
+        return NULL;
+    }
+    lmsm_trace_header *header = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    // the blocks must fit the file and each hold its own header, kept aligned
+    size_t block_space = info.st_size - sizeof(lmsm_trace_header);
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+        (header->address_radix != ADDRESS_RADIX && header->address_radix != WIDE_ADDRESS_RADIX) ||
+        header->block_count == 0 || header->block_size < sizeof(lmsm_trace_block) ||
+        header->block_size % sizeof(lmsm_trace_block) != 0 ||
+        header->block_count > block_space / header->block_size) {
+        munmap(header, info.st_size);
+        close(fd);
+        return NULL;
+    }
+    lmsm_trace *trace = calloc(1, sizeof(lmsm_trace));
+    trace->header = header;
+    trace->region_size = info.st_size;
+    trace->fd = fd;
+    return trace;
+}
+
+void lmsm_trace_delete(lmsm_trace *trace) {
+    if (trace->fd >= 0) {
+        munmap(trace->header, trace->region_size);
+        close(trace->fd);
+    } else {
+        free(trace->header);
+    }
+    free(trace);
+}
+
+//======================================================
+// Recording
+//======================================================
+
+unsigned char *lmsm_trace_block_start(lmsm_trace_header *header, unsigned long long block) {
+    return (unsigned char *) (header + 1) + (block % header->block_count) * header->block_size;
+}
+
+void lmsm_trace_start_block(lmsm_trace *trace) {
+    unsigned char *start = lmsm_trace_block_start(trace->header, trace->header->blocks_written);
+    trace->header->blocks_written++;
+
+    trace->block = (lmsm_trace_block *) start;
+    trace->block->first_step = trace->step;
+    trace->block->used = 0;
+    trace->block->records = 0;
+    trace->cursor = start + sizeof(lmsm_trace_block);
+    trace->block_end = start + trace->header->block_size;
+
+    // every block decodes on its own, so deltas restart from a blank state
+    trace->last_program_counter = -1;
+    trace->last_accumulator = 0;
+    trace->last_stack_pointer = 0;
+    memset(trace->last_instruction, 0xFF, sizeof(trace->last_instruction));
+}
+
+void lmsm_trace_record(lmsm_trace *trace, int program_counter, int instruction, int accumulator, int stack_pointer) {
+    if (trace->block_end - trace->cursor < TRACE_MAX_RECORD) {
+        lmsm_trace_start_block(trace);
+    }
+    unsigned char *flags = trace->cursor;
+    unsigned char *cursor = flags + 1;
+    *flags = 0;
+
+    if (program_counter == trace->last_program_counter + 1) {
+        *flags |= TRACE_SEQUENTIAL_PC;
+    } else {
+        cursor = lmsm_trace_put_varint(cursor, lmsm_trace_zigzag(program_counter - trace->last_program_counter));
+    }
+    int in_memory = 0 <= program_counter && program_counter < MAX_MEMORY_SIZE;
+    if (in_memory && trace->last_instruction[program_counter] == instruction) {
+        *flags |= TRACE_SAME_INSTRUCTION;
+    } else {
+        cursor = lmsm_trace_put_varint(cursor, lmsm_trace_zigzag(instruction));
+        if (in_memory) {
+            trace->last_instruction[program_counter] = instruction;
+        }
+    }
+    if (accumulator == trace->last_accumulator) {
+        *flags |= TRACE_SAME_ACCUMULATOR;
+    } else {
+        cursor = lmsm_trace_put_varint(cursor, lmsm_trace_zigzag(accumulator - trace->last_accumulator));
+    }
+    if (stack_pointer == trace->last_stack_pointer) {
+        *flags |= TRACE_SAME_STACK_POINTER;
+    } else {
+        cursor = lmsm_trace_put_varint(cursor, lmsm_trace_zigzag(stack_pointer - trace->last_stack_pointer));
+    }
+
+    trace->last_program_counter = program_counter;
+    trace->last_accumulator = accumulator;
+    trace->last_stack_pointer = stack_pointer;
+    trace->cursor = cursor;
+    trace->step++;
+    trace->block->used = (unsigned int) (cursor - (unsigned char *) (trace->block + 1));
+    trace->block->records++;
+}
+
+//======================================================
+// Decoding
+//======================================================
+
+// prints the records of a block, returns 0 if they do not fill exactly the bytes it says it used
+int lmsm_trace_decode_block(lmsm_trace_block *block, unsigned int block_size, int address_radix,
+                            int *last_instruction, FILE *out) {
+    int program_counter = -1;
+    int accumulator = 0;
+    int stack_pointer = 0;
+    memset(last_instruction, 0xFF, sizeof(int) * MAX_MEMORY_SIZE);
+
+    if (block->used > block_size - sizeof(lmsm_trace_block) || block->records > block->used) {
+        return 0;
+    }
+    unsigned char *cursor = (unsigned char *) (block + 1);
+    unsigned char *end = cursor + block->used;
+    unsigned int value;
+    char assembly[20];
+    for (unsigned int record = 0; record < block->records; ++record) {
+        if (cursor == end) {
+            return 0;
+        }
+        unsigned char flags = *cursor++;
+        int instruction;
+
+        if (flags & TRACE_SEQUENTIAL_PC) {
+            program_counter++;
+        } else {
+            if ((cursor = lmsm_trace_get_varint(cursor, end, &value)) == NULL) {
+                return 0;
+            }
+            program_counter += lmsm_trace_unzigzag(value);
+        }
+        int in_memory = 0 <= program_counter && program_counter < MAX_MEMORY_SIZE;
+        if (flags & TRACE_SAME_INSTRUCTION) {
+            instruction = in_memory ? last_instruction[program_counter] : 0;
+        } else {
+            if ((cursor = lmsm_trace_get_varint(cursor, end, &value)) == NULL) {
+                return 0;
+            }
+            instruction = lmsm_trace_unzigzag(value);
+            if (in_memory) {
+                last_instruction[program_counter] = instruction;
+            }
+        }
+        if (!(flags & TRACE_SAME_ACCUMULATOR)) {
+            if ((cursor = lmsm_trace_get_varint(cursor, end, &value)) == NULL) {
+                return 0;
+            }
+            accumulator += lmsm_trace_unzigzag(value);
+        }
+        if (!(flags & TRACE_SAME_STACK_POINTER)) {
+            if ((cursor = lmsm_trace_get_varint(cursor, end, &value)) == NULL) {
+                return 0;
+            }
+            stack_pointer += lmsm_trace_unzigzag(value);
+        }
+
+        asm_disassemble(instruction, address_radix, assembly);
+        fprintf(out, "%10llu   %02d   %03d   %-12s   %03d          %03d\n",
+                block->first_step + record, program_counter, instruction, assembly, accumulator, stack_pointer);
+    }
+    return cursor == end;
+}
+
+int lmsm_trace_decode(lmsm_trace *trace, FILE *out) {
+    lmsm_trace_header *header = trace->header;
+    unsigned long long first = 0;
+    if (header->blocks_written > header->block_count) {
+        first = header->blocks_written - header->block_count;
+    }
+    int *last_instruction = malloc(sizeof(int) * MAX_MEMORY_SIZE);
+    int intact = 1;
+    fprintf(out, "      Step   PC   Word  Instruction    Accumulator  Stack Pointer\n");
+    for (unsigned long long block = first; block < header->blocks_written && intact; ++block) {
+        intact = lmsm_trace_decode_block((lmsm_trace_block *) lmsm_trace_block_start(header, block),
+                                         header->block_size, (int) header->address_radix, last_instruction, out);
+    }
+    free(last_instruction);
+    return intact;
+}
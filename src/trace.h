@@ -0,0 +1,67 @@
+#ifndef LMSM_TRACE_H
+#define LMSM_TRACE_H
+
+#include <stdio.h>
+#include "lmsm.h"
+
+#define TRACE_MAGIC 0x52544D4C   // "LMTR"
+#define TRACE_VERSION 2
+#define TRACE_BLOCK_SIZE 4096
+#define TRACE_DEFAULT_BLOCKS 64
+#define TRACE_MAX_RECORD 21      // flag byte plus four 5 byte varints
+
+//===================================================================
+//  The trace is a ring of fixed size blocks.  Each block starts from
+//  a blank state so the oldest block can be overwritten without
+//  breaking the delta encoding of the ones after it.
+//===================================================================
+
+typedef struct lmsm_trace_header {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int block_size;
+    unsigned int block_count;
+    unsigned int address_radix;         // how to disassemble the recorded words
+    unsigned long long blocks_written;  // the newest block is (blocks_written - 1) % block_count
+} lmsm_trace_header;
+
+typedef struct lmsm_trace_block {
+    unsigned long long first_step;      // the step number of the first record in the block
+    unsigned int used;                  // bytes of records in the block
+    unsigned int records;               // number of records in the block
+} lmsm_trace_block;
+
+typedef struct lmsm_trace {
+    lmsm_trace_header *header;          // start of the (possibly mmap'd) region
+    size_t region_size;
+    int fd;                             // backing file, -1 when the trace lives in memory
+    lmsm_trace_block *block;            // the block being written
+    unsigned char *cursor;              // next byte to write in the block
+    unsigned char *block_end;
+    unsigned long long step;
+    int last_program_counter;
+    int last_accumulator;
+    int last_stack_pointer;
+    int last_instruction[MAX_MEMORY_SIZE]; // last word executed at each slot, -1 if not seen in this block
+} lmsm_trace;
+
+//=====================================================
+// API
+//=====================================================
+
+// creates a trace of block_count blocks, backed by an mmap'd file when path is not NULL
+lmsm_trace *lmsm_trace_create(int block_count, int address_radix, char *path);
+
+// opens an existing trace file for decoding
+lmsm_trace *lmsm_trace_open(char *path);
+
+void lmsm_trace_delete(lmsm_trace *trace);
+
+// records one executed instruction and the machine state after it
+void lmsm_trace_record(lmsm_trace *trace, int program_counter, int instruction, int accumulator, int stack_pointer);
+
+// prints the trace, oldest step first, as LMSM assembly with machine state columns, returns 0 if it stopped at a
+// corrupt block
+int lmsm_trace_decode(lmsm_trace *trace, FILE *out);
+
+#endif //LMSM_TRACE_H